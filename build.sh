@@ -22,4 +22,6 @@ echo $cpp_flags > "$base_dir/$name.cxxflags"
 
 pushd "$build_dir" > /dev/null
 gcc "$src_dir/x11_platform.cpp" -lm -lc -lX11 -lXext -ldl -lasound $cpp_flags
+gcc "$src_dir/telemetry_reader.cpp" -o telemetry_reader -lc $cpp_flags
+gcc "$src_dir/soak.cpp" -o soak -lm -lc $cpp_flags
 popd > /dev/null
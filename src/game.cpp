@@ -1,15 +1,153 @@
 #include "game.h"
+#include "game_entity.cpp"
+#include "game_particles.cpp"
+#include "game_spatial.cpp"
+#include "game_text.cpp"
+#include "game_tilemap.cpp"
+#include "game_wav.cpp"
+#include "memory_arena.h"
 #include "types.h"
 #include <math.h>
 #include <stdio.h>
 
+const auto music_track_path = "data/music.wav";
+
+const auto pad_speed = 480.f; // Pixels per second at full stick deflection
+const auto key_speed = 120.f;
+
+const auto initial_entity_count = 2048;
+const auto entities_per_update = 64; // Spawned or destroyed while rb or lb are held
+const auto entity_bounds_width = 1280.f;
+const auto entity_bounds_height = 720.f;
+const auto entity_max_radius = 3.f;
+const auto max_collision_pairs = 1 << 18;
+const auto entity_job_batch_size = 4096;
+const auto draw_rows_per_job = 16;
+
+const auto particles_per_update = 512; // At full stick deflection, or with a direction key held
+const auto particle_life = 2.f; // Seconds
+const auto particle_speed = 360.f;
+const auto particle_spread = 0.35f; // Of the spray direction, as a fraction of the speed
+
+const auto world_room_count = 512;
+const auto world_room_spread = 4096; // Tiles from the origin in every direction
+const u32 tile_colors[] = { 0, 0x7F7F9F, 0x3F8F3F, 0x9F5F2F, 0x2F4F9F };
+
+const auto hud_text_scale = 2;
+const auto hud_margin = 8;
+
 struct GameState {
-	int x_offset, y_offset;
+	float x_offset, y_offset;
+	float prev_x_offset, prev_y_offset;
+	int tone_hz;
+	float t_sine; // Phase of the tone
+	u32 random_state;
+	WavStream music;
+
+	MemoryArena perm_arena; // Everything in perm_storage after GameState
+	MemoryArena trans_arena; // All of trans_storage, reset every update
+	EntityWorld entities;
+	u32 collision_pair_count;
+	ParticleSystem particles;
+	TileMap tilemap;
+	TextCache* text;
+	u32 palette[256]; // What indexed frames are shown through, changing it recolours the next present
 };
 
-void game_output_sound(GameSoundBuffer& sound_output, const int tone_hz)
+void game_parallel_for(GameMemory& mem, const u32 count, const u32 batch_size, JobRangeFunc* const func, void* const data)
+{
+	if (mem.jobs.parallel_for)
+		mem.jobs.parallel_for(count, batch_size, func, data);
+	else
+		func(data, 0, count);
+}
+
+struct EntityJob {
+	EntityWorld* world;
+	SpatialGrid* grid;
+	float dt;
+};
+
+void integrate_entities_job(void* data, u32 begin, u32 end)
+{
+	auto& job = *(EntityJob*)data;
+	entity_integrate(*job.world, job.dt, begin, end);
+}
+
+void compute_grid_keys_job(void* data, u32 begin, u32 end)
+{
+	auto& job = *(EntityJob*)data;
+	spatial_grid_compute_keys(*job.grid, job.world->pos_x, job.world->pos_y, begin, end);
+}
+
+u32 random_next(u32& state)
+{
+	// xorshift32
+	auto x = state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return state = x;
+}
+
+float random_unilateral(u32& state)
+{
+	return (float)(random_next(state) >> 8) / (float)(1 << 24);
+}
+
+float random_bilateral(u32& state)
+{
+	return 2.f * random_unilateral(state) - 1.f;
+}
+
+void spawn_entity(GameState& state)
+{
+	auto& world = state.entities;
+	const auto handle = entity_create(world);
+	if (!handle.generation)
+		return;
+
+	const auto i = entity_dense_index(world, handle);
+	world.pos_x[i] = world.prev_x[i] = random_unilateral(state.random_state) * entity_bounds_width;
+	world.pos_y[i] = world.prev_y[i] = random_unilateral(state.random_state) * entity_bounds_height;
+	world.vel_x[i] = random_bilateral(state.random_state) * 200.f;
+	world.vel_y[i] = random_bilateral(state.random_state) * 200.f;
+	world.radius[i] = 1.f + random_unilateral(state.random_state) * (entity_max_radius - 1.f);
+	world.color[i] = random_next(state.random_state) | 0x404040;
+}
+
+// Sprays out of the middle of the view, away from where the controller points
+void emit_particles(GameState& state, const GameCtrlInput& ctrl)
+{
+	auto dir_x = ctrl.end_x + (float)ctrl.right.ended_down - (float)ctrl.left.ended_down;
+	auto dir_y = ctrl.end_y + (float)ctrl.down.ended_down - (float)ctrl.up.ended_down;
+	const auto length = sqrtf(dir_x * dir_x + dir_y * dir_y);
+	if (length <= 0.f)
+		return;
+
+	dir_x /= length;
+	dir_y /= length;
+	const auto strength = length < 1.f ? length : 1.f;
+	const auto emit_count = (int)(particles_per_update * strength);
+	auto& particles = state.particles;
+	auto& random = state.random_state;
+	for (int n = 0; n < emit_count; n++) {
+		const auto i = particle_add(particles);
+		if (i == particles.capacity)
+			return;
+
+		const auto speed = particle_speed * (0.5f + 0.5f * random_unilateral(random));
+		particles.pos_x[i] = particles.prev_x[i] = state.x_offset + entity_bounds_width / 2;
+		particles.pos_y[i] = particles.prev_y[i] = state.y_offset + entity_bounds_height / 2;
+		particles.vel_x[i] = (-dir_x + random_bilateral(random) * particle_spread) * speed;
+		particles.vel_y[i] = (-dir_y + random_bilateral(random) * particle_spread) * speed;
+		particles.life[i] = particle_life * (0.5f + 0.5f * random_unilateral(random));
+		particles.color[i] = 0x402008 + (random_next(random) & 0x1F0F07);
+	}
+}
+
+void game_output_sound(GameSoundBuffer& sound_output, const int tone_hz, float& t_sine)
 {
-	static float t_sine = 0;
 	const auto tone_volume = 3000;
 	const auto wave_period = (float)sound_output.frame_rate / tone_hz;
 	for (int i = 0; i < sound_output.frame_count; i++) {
@@ -22,54 +160,342 @@ void game_output_sound(GameSoundBuffer& sound_output, const int tone_hz)
 	}
 }
 
-void game_draw_thing(const GameScreenBuffer& buffer, const int x_offset, const int y_offset)
+// Equal-mass elastic response: separate the pair and exchange their velocities along the contact normal
+void resolve_entity_collisions(EntityWorld& world, const EntityPair* const pairs, const u32 pair_count)
 {
-	for (int y = 0; y < buffer.height; y++) {
-		auto row = buffer.buffer + (y * buffer.pitch());
-		for (int x = 0; x < buffer.width; x++) {
-			auto p = (u32*)(row + (x * buffer.pixel_bytes()));
+	for (u32 i = 0; i < pair_count; i++) {
+		const auto a = pairs[i].a;
+		const auto b = pairs[i].b;
+		const auto dx = world.pos_x[b] - world.pos_x[a];
+		const auto dy = world.pos_y[b] - world.pos_y[a];
+		const auto distance = sqrtf(dx * dx + dy * dy);
+		if (distance <= 0.f)
+			continue;
+
+		const auto nx = dx / distance;
+		const auto ny = dy / distance;
+		const auto push = 0.5f * (world.radius[a] + world.radius[b] - distance);
+		world.pos_x[a] -= nx * push;
+		world.pos_y[a] -= ny * push;
+		world.pos_x[b] += nx * push;
+		world.pos_y[b] += ny * push;
+
+		const auto relative_speed = (world.vel_x[b] - world.vel_x[a]) * nx + (world.vel_y[b] - world.vel_y[a]) * ny;
+		if (relative_speed >= 0.f)
+			continue;
+		world.vel_x[a] += relative_speed * nx;
+		world.vel_y[a] += relative_speed * ny;
+		world.vel_x[b] -= relative_speed * nx;
+		world.vel_y[b] -= relative_speed * ny;
+	}
+}
+
+template<typename Format>
+void game_draw_rect(const GameScreenBuffer& buffer, int min_x, int min_y, int max_x, int max_y, const u32 color)
+{
+	if (min_x < 0)
+		min_x = 0;
+	if (min_y < 0)
+		min_y = 0;
+	if (max_x > buffer.width)
+		max_x = buffer.width;
+	if (max_y > buffer.height)
+		max_y = buffer.height;
+
+	const auto pitch = buffer.width * Format::bytes;
+	const auto packed = Format::pack(color);
+	for (int y = min_y; y < max_y; y++) {
+		auto p = (u8*)buffer.buffer + y * pitch + min_x * Format::bytes;
+		for (int x = min_x; x < max_x; x++) {
+			Format::store(p, packed);
+			p += Format::bytes;
+		}
+	}
+}
+
+i32 floor_div(const i32 a, const i32 b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Only visits the chunks overlapping the view, so cost follows screen size and not world size
+template<typename Format>
+void game_draw_tilemap(const GameScreenBuffer& buffer, TileMap& map, const int camera_x, const int camera_y)
+{
+	const auto chunk_pixels = tile_chunk_dim * tile_size;
+	const auto min_chunk_x = floor_div(camera_x, chunk_pixels);
+	const auto min_chunk_y = floor_div(camera_y, chunk_pixels);
+	const auto max_chunk_x = floor_div(camera_x + buffer.width - 1, chunk_pixels);
+	const auto max_chunk_y = floor_div(camera_y + buffer.height - 1, chunk_pixels);
+
+	for (auto chunk_y = min_chunk_y; chunk_y <= max_chunk_y; chunk_y++) {
+		for (auto chunk_x = min_chunk_x; chunk_x <= max_chunk_x; chunk_x++) {
+			const auto chunk = get_tile_chunk(map, chunk_x, chunk_y);
+			if (!chunk)
+				continue;
+
+			const auto chunk_screen_x = chunk_x * chunk_pixels - camera_x;
+			const auto chunk_screen_y = chunk_y * chunk_pixels - camera_y;
+			for (int tile_y = 0; tile_y < tile_chunk_dim; tile_y++) {
+				const auto y = chunk_screen_y + tile_y * tile_size;
+				if (y + tile_size <= 0 || y >= buffer.height)
+					continue;
+
+				for (int tile_x = 0; tile_x < tile_chunk_dim; tile_x++) {
+					const auto tile = chunk->tiles[tile_y * tile_chunk_dim + tile_x];
+					if (!tile)
+						continue;
+
+					const auto x = chunk_screen_x + tile_x * tile_size;
+					const auto color = tile_colors[tile % (sizeof(tile_colors) / sizeof(tile_colors[0]))];
+					game_draw_rect<Format>(buffer, x, y, x + tile_size, y + tile_size, color);
+				}
+			}
+		}
+	}
+}
+
+template<typename Format>
+void game_draw_entities(const GameScreenBuffer& buffer, const EntityWorld& world, const int camera_x, const int camera_y, const float alpha)
+{
+	for (u32 i = 0; i < world.count; i++) {
+		const auto x = world.prev_x[i] + (world.pos_x[i] - world.prev_x[i]) * alpha - camera_x;
+		const auto y = world.prev_y[i] + (world.pos_y[i] - world.prev_y[i]) * alpha - camera_y;
+		const auto r = world.radius[i];
+		game_draw_rect<Format>(buffer, (int)(x - r), (int)(y - r), (int)(x + r), (int)(y + r), world.color[i]);
+	}
+}
 
-			*p = (u8)(y + y_offset) | (u8)(x + x_offset);
+void make_world_room(GameState& state, const i32 min_x, const i32 min_y, const i32 width, const i32 height, const u8 tile)
+{
+	for (auto x = min_x; x < min_x + width; x++) {
+		set_tile(state.tilemap, state.perm_arena, x, min_y, tile);
+		set_tile(state.tilemap, state.perm_arena, x, min_y + height - 1, tile);
+	}
+	for (auto y = min_y; y < min_y + height; y++) {
+		set_tile(state.tilemap, state.perm_arena, min_x, y, tile);
+		set_tile(state.tilemap, state.perm_arena, min_x + width - 1, y, tile);
+	}
+}
+
+void make_world(GameState& state)
+{
+	make_world_room(state, 2, 2, 76, 41, 1);
+	for (int i = 0; i < world_room_count; i++) {
+		auto& random = state.random_state;
+		const auto x = (i32)(random_bilateral(random) * world_room_spread);
+		const auto y = (i32)(random_bilateral(random) * world_room_spread);
+		const auto width = 4 + (i32)(random_next(random) % 40);
+		const auto height = 4 + (i32)(random_next(random) % 24);
+		const auto tile = (u8)(1 + random_next(random) % 4);
+		make_world_room(state, x, y, width, height, tile);
+	}
+}
+
+template<typename Format>
+void game_draw_thing(const GameScreenBuffer& buffer, const int x_offset, const int y_offset, const int min_y, const int max_y)
+{
+	const auto pitch = buffer.width * Format::bytes;
+	for (int y = min_y; y < max_y; y++) {
+		auto p = (u8*)buffer.buffer + y * pitch;
+		for (int x = 0; x < buffer.width; x++) {
+			Format::store(p, Format::pack((u8)(y + y_offset) | (u8)(x + x_offset)));
+			p += Format::bytes;
 		}
 	}
 }
 
-void game_update_and_render(GameMemory& mem, const GameScreenBuffer& buffer, GameSoundBuffer& sound_buffer, const GameInput& input)
+struct DrawThingJob {
+	const GameScreenBuffer* buffer;
+	int x_offset, y_offset;
+};
+
+template<typename Format>
+void draw_thing_job(void* data, u32 begin, u32 end)
+{
+	auto& job = *(DrawThingJob*)data;
+	game_draw_thing<Format>(*job.buffer, job.x_offset, job.y_offset, begin, end);
+}
+
+// Drop-shadowed line of HUD text, returns where the next line goes
+template<typename Format>
+int game_draw_hud_line(TextCache& text, const GameScreenBuffer& buffer, const int y, const char* const line)
+{
+	text_draw<Format>(text, buffer, hud_margin + 2, y + 2, line, 0x000000);
+	return y + text_draw<Format>(text, buffer, hud_margin, y, line, 0xFFFFFF).height;
+}
+
+// One string per line, so a line that didn't change this frame is drawn straight from its cached layout
+template<typename Format>
+void game_draw_hud(const GameScreenBuffer& buffer, const GameMemory& mem, GameState& state, const int camera_x, const int camera_y)
+{
+	auto& text = *state.text;
+	text_begin_frame(text);
+
+	char line[max_text_length];
+	auto y = hud_margin;
+	snprintf(line, sizeof(line), "Entities %u  Contacts %u  Particles %u", state.entities.count, state.collision_pair_count, state.particles.count);
+	y = game_draw_hud_line<Format>(text, buffer, y, line);
+	snprintf(line, sizeof(line), "Camera %i, %i  Chunks %u", camera_x, camera_y, state.tilemap.chunk_count);
+	y = game_draw_hud_line<Format>(text, buffer, y, line);
+	snprintf(line, sizeof(line), "Perm %llu KiB  Trans %llu KiB", mem.perm_storage_used / KiB(1), mem.trans_storage_used / KiB(1));
+	y = game_draw_hud_line<Format>(text, buffer, y, line);
+}
+
+GameState& get_game_state(GameMemory& mem)
 {
 	assert(sizeof(GameState) <= mem.perm_storage_size);
 	auto& state = *(GameState*)mem.perm_storage;
 	if (!mem.is_initialized) {
 		state.x_offset = 0;
 		state.y_offset = 0;
+		state.prev_x_offset = 0;
+		state.prev_y_offset = 0;
+		state.tone_hz = 256;
+		state.t_sine = 0;
+		state.random_state = 0x12345678;
 		mem.is_initialized = true;
 
+		arena_init(state.perm_arena, (u8*)mem.perm_storage + sizeof(GameState), mem.perm_storage_size - sizeof(GameState));
+		arena_init(state.trans_arena, mem.trans_storage, mem.trans_storage_size);
+		entity_world_init(state.entities, state.perm_arena, max_entity_count);
+		particle_system_init(state.particles, state.perm_arena, max_particle_count);
+		for (int i = 0; i < initial_entity_count; i++) {
+			spawn_entity(state);
+		}
+		make_world(state);
+		for (int i = 0; i < 256; i++) {
+			state.palette[i] = pixel_rgb332_to_rgb((u8)i);
+		}
+		state.text = arena_push_struct<TextCache>(state.perm_arena);
+		text_cache_init(*state.text, state.perm_arena, hud_text_scale);
+
 		const auto file = platform_read_entire_file(__FILE__);
 		if (file.mem) {
 			platform_write_entire_file("arroz.txt", file.mem, file.size);
 			free(file.mem);
 		}
+
+		if (platform_file_exists(music_track_path))
+			wav_stream_open(state.music, music_track_path);
+		else
+			printf("[WAV]: No %s, music disabled\n", music_track_path);
 	}
+	return state;
+}
+
+void game_update(GameMemory& mem, const GameInput& input, const float dt)
+{
+	auto& state = get_game_state(mem);
+	arena_reset(state.trans_arena);
+	state.prev_x_offset = state.x_offset;
+	state.prev_y_offset = state.y_offset;
 
 	const auto& input0 = input.ctrls[0];
 	const auto& input1 = input.ctrls[1];
-	const auto tone_hz = 256 + (int)(128.f * input1.end_x);
-	state.x_offset += (int)(4.0f * input1.end_x);
-	state.y_offset += (int)(4.0f * input1.end_y);
+	state.tone_hz = 256 + (int)(128.f * input1.end_x);
+	state.x_offset += pad_speed * input1.end_x * dt;
+	state.y_offset += pad_speed * input1.end_y * dt;
 
-	// printf("%i\n", input0.down.ended_down);
 	if (input0.down.ended_down) {
-		state.y_offset += 1;
+		state.y_offset += key_speed * dt;
 	}
 	if (input0.up.ended_down) {
-		state.y_offset -= 1;
+		state.y_offset -= key_speed * dt;
 	}
 	if (input0.left.ended_down) {
-		state.x_offset -= 1;
+		state.x_offset -= key_speed * dt;
 	}
 	if (input0.right.ended_down) {
-		state.x_offset += 1;
+		state.x_offset += key_speed * dt;
+	}
+
+	auto& world = state.entities;
+	if (input0.rb.ended_down) {
+		for (int i = 0; i < entities_per_update; i++) {
+			spawn_entity(state);
+		}
+	}
+	if (input0.lb.ended_down) {
+		for (int i = 0; i < entities_per_update && world.count; i++) {
+			entity_destroy(world, entity_handle_of_dense(world, 0));
+		}
+	}
+
+	SpatialGrid grid;
+	EntityJob entity_job = { .world = &world, .grid = &grid, .dt = dt };
+	game_parallel_for(mem, world.count, entity_job_batch_size, integrate_entities_job, &entity_job);
+
+	auto pairs = arena_push_array<EntityPair>(state.trans_arena, max_collision_pairs);
+	if (pairs && spatial_grid_init(grid, state.trans_arena, world.count, 2.f * entity_max_radius)) {
+		game_parallel_for(mem, world.count, entity_job_batch_size, compute_grid_keys_job, &entity_job);
+		spatial_grid_sort(grid, state.trans_arena, world.pos_x, world.pos_y);
+		const auto pair_count = spatial_find_pairs(grid, world.radius, pairs, max_collision_pairs);
+		resolve_entity_collisions(world, pairs, pair_count);
+		state.collision_pair_count = pair_count;
+	}
+
+	entity_bounce_in_bounds(world, 0, 0, entity_bounds_width, entity_bounds_height);
+
+	auto& particles = state.particles;
+	const auto particle_batch_count = (particles.count + particle_job_batch_size - 1) / particle_job_batch_size;
+	ParticleJob particle_job = { .particles = &particles, .dt = dt };
+	game_parallel_for(mem, particle_batch_count, 1, particle_update_job, &particle_job);
+	particle_close_batch_gaps(particles, particle_batch_count);
+	for (const auto& ctrl : input.ctrls) {
+		emit_particles(state, ctrl);
 	}
 
-	game_output_sound(sound_buffer, tone_hz);
-	game_draw_thing(buffer, state.x_offset, state.y_offset);
+	mem.perm_storage_used = sizeof(GameState) + state.perm_arena.used;
+	mem.trans_storage_used = state.trans_arena.used;
+}
+
+// Everything that touches pixels, instantiated once per PixelFormat
+template<typename Format>
+void game_draw_frame(GameMemory& mem, GameState& state, const GameScreenBuffer& buffer, const int camera_x, const int camera_y, const float alpha)
+{
+	DrawThingJob draw_job = { .buffer = &buffer, .x_offset = camera_x, .y_offset = camera_y };
+	game_parallel_for(mem, buffer.height, draw_rows_per_job, draw_thing_job<Format>, &draw_job);
+	game_draw_tilemap<Format>(buffer, state.tilemap, camera_x, camera_y);
+	game_draw_entities<Format>(buffer, state.entities, camera_x, camera_y, alpha);
+	particles_draw<Format>(buffer, state.particles, camera_x, camera_y, alpha, particle_life);
+	game_draw_hud<Format>(buffer, mem, state, camera_x, camera_y);
+}
+
+void game_render(GameMemory& mem, const GameScreenBuffer& buffer, GameSoundBuffer& sound_buffer, const float alpha)
+{
+	auto& state = get_game_state(mem);
+
+	const auto x_offset = state.prev_x_offset + (state.x_offset - state.prev_x_offset) * alpha;
+	const auto y_offset = state.prev_y_offset + (state.y_offset - state.prev_y_offset) * alpha;
+
+	game_output_sound(sound_buffer, state.tone_hz, state.t_sine);
+	wav_stream_mix(state.music, sound_buffer);
+	const auto camera_x = (int)floorf(x_offset);
+	const auto camera_y = (int)floorf(y_offset);
+	switch (buffer.format) {
+	case PixelFormat_BGRX32:
+		game_draw_frame<PixelBGRX32>(mem, state, buffer, camera_x, camera_y, alpha);
+		break;
+	case PixelFormat_BGR24:
+		game_draw_frame<PixelBGR24>(mem, state, buffer, camera_x, camera_y, alpha);
+		break;
+	case PixelFormat_RGB565:
+		game_draw_frame<PixelRGB565>(mem, state, buffer, camera_x, camera_y, alpha);
+		break;
+	case PixelFormat_Indexed8:
+		game_draw_frame<PixelIndexed8>(mem, state, buffer, camera_x, camera_y, alpha);
+		memcpy(buffer.palette, state.palette, sizeof(state.palette));
+		break;
+	}
+
+	// Before the first update this is the first report, render only writes into what's already allocated
+	mem.perm_storage_used = sizeof(GameState) + state.perm_arena.used;
+}
+
+GameSummary game_summarize(GameMemory& mem)
+{
+	const auto& state = get_game_state(mem);
+	return { .x_offset = state.x_offset, .y_offset = state.y_offset, .entity_count = state.entities.count,
+		.particle_count = state.particles.count, .collision_pair_count = state.collision_pair_count };
 }
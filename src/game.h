@@ -1,4 +1,5 @@
 #pragma once
+#include "pixel_format.h"
 #include "types.h"
 
 #if INTERNAL
@@ -10,6 +11,15 @@ buffer platform_read_entire_file(const char* const filename);
 bool platform_write_entire_file(const char* const filename, void* const mem, const u32 mem_size);
 #endif
 
+struct PlatformFile {
+	int handle;
+	u64 size;
+};
+bool platform_file_exists(const char* const filename);
+bool platform_open_file(const char* const filename, PlatformFile& file);
+i64 platform_read_file(const PlatformFile& file, const u64 offset, void* const dest, const u64 size);
+void platform_close_file(PlatformFile& file);
+
 struct GameScreenBuffer {
 	int width;
 	int height;
@@ -20,6 +30,8 @@ struct GameScreenBuffer {
 		return pixel_bits / 8;
 	}
 	int pitch() const { return width * pixel_bytes(); }
+	PixelFormat format; // Has to agree with pixel_bits, game_render dispatches on it once per frame
+	u32* palette; // PixelFormat_Indexed8 only, 256 0xRRGGBB entries the game sets every frame and the platform presents through
 };
 
 struct GameSoundBuffer {
@@ -66,12 +78,48 @@ struct GameInput {
 	GameCtrlInput ctrls[max_joy_count + max_keyboard_count]; // @Volatile_max_joy_count
 };
 
+struct JobGroup {
+	i32 pending; // Jobs added and not finished yet, only touched atomically
+};
+
+typedef void JobFunc(void* data);
+typedef void JobRangeFunc(void* data, u32 begin, u32 end);
+
+// Filled in by the platform, jobs run on a shared pool of one thread per core
+struct PlatformJobs {
+	int thread_count;
+	void (*add_job)(JobGroup& group, JobFunc* func, void* data);
+	void (*wait_for_group)(JobGroup& group); // Runs queued jobs on the calling thread while it waits
+	void (*parallel_for)(u32 count, u32 batch_size, JobRangeFunc* func, void* data); // batch_size 0 picks one
+};
+
 struct GameMemory {
+	PlatformJobs jobs;
 	u64 perm_storage_size;
 	void* perm_storage;
 	u64 trans_storage_size;
 	void* trans_storage;
 	bool is_initialized;
+
+	// Reported back by the game, bytes in use at the end of the last update
+	u64 perm_storage_used;
+	u64 trans_storage_used;
+};
+
+// The simulation always advances in steps of game_update_dt, the platform runs as many as the elapsed time needs
+const auto game_update_hz = 120;
+const auto game_update_dt = 1.f / game_update_hz;
+
+void game_update(GameMemory& memory, const GameInput& input, const float dt);
+// alpha is how far (0..1) real time is between the last two simulated states
+void game_render(GameMemory& memory, const GameScreenBuffer& buffer, GameSoundBuffer& sound_buffer, const float alpha);
+
+// A few numbers that tell simulated states apart, for the platform to compare runs without looking into perm_storage
+struct GameSummary {
+	float x_offset, y_offset;
+	u32 entity_count;
+	u32 particle_count;
+	u32 collision_pair_count;
 };
 
-void game_update_and_render(GameMemory& memory, const GameScreenBuffer& buffer, GameSoundBuffer& sound_buffer, const GameInput& input);
+GameSummary game_summarize(GameMemory& memory);
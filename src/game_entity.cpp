@@ -0,0 +1,173 @@
+#include "memory_arena.h"
+#include "types.h"
+
+// Entities are sparse-set slots with generation counters; components live in dense struct-of-arrays so
+// systems walk contiguous memory. Destroying an entity swaps the last dense entry into its place.
+
+const u32 max_entity_count = 1 << 17;
+const u32 invalid_dense_index = 0xFFFFFFFF;
+
+struct EntityHandle {
+	u32 slot;
+	u32 generation; // 0 is never a live generation, so a zeroed handle is null
+};
+
+struct EntityWorld {
+	u32 capacity;
+	u32 count;
+
+	u32* dense_of_slot;
+	u32* slot_of_dense;
+	u32* generations;
+	u32* free_slots;
+	u32 free_count;
+
+	// Components, indexed by dense index
+	float* pos_x;
+	float* pos_y;
+	float* prev_x;
+	float* prev_y;
+	float* vel_x;
+	float* vel_y;
+	float* radius;
+	u32* color;
+};
+
+bool entity_world_init(EntityWorld& world, MemoryArena& arena, const u32 capacity)
+{
+	world = {};
+	world.capacity = capacity;
+
+	world.dense_of_slot = arena_push_array<u32>(arena, capacity);
+	world.slot_of_dense = arena_push_array<u32>(arena, capacity);
+	world.generations = arena_push_array<u32>(arena, capacity);
+	world.free_slots = arena_push_array<u32>(arena, capacity);
+
+	world.pos_x = arena_push_array<float>(arena, capacity);
+	world.pos_y = arena_push_array<float>(arena, capacity);
+	world.prev_x = arena_push_array<float>(arena, capacity);
+	world.prev_y = arena_push_array<float>(arena, capacity);
+	world.vel_x = arena_push_array<float>(arena, capacity);
+	world.vel_y = arena_push_array<float>(arena, capacity);
+	world.radius = arena_push_array<float>(arena, capacity);
+	world.color = arena_push_array<u32>(arena, capacity);
+
+	if (!world.color)
+		return false;
+
+	// Popped from the back, so slot 0 is handed out first
+	for (u32 i = 0; i < capacity; i++) {
+		world.free_slots[i] = capacity - 1 - i;
+		world.generations[i] = 1;
+		world.dense_of_slot[i] = invalid_dense_index;
+	}
+	world.free_count = capacity;
+
+	return true;
+}
+
+bool entity_is_alive(const EntityWorld& world, const EntityHandle handle)
+{
+	return handle.slot < world.capacity && handle.generation == world.generations[handle.slot]
+		&& world.dense_of_slot[handle.slot] != invalid_dense_index;
+}
+
+u32 entity_dense_index(const EntityWorld& world, const EntityHandle handle)
+{
+	return entity_is_alive(world, handle) ? world.dense_of_slot[handle.slot] : invalid_dense_index;
+}
+
+EntityHandle entity_handle_of_dense(const EntityWorld& world, const u32 dense)
+{
+	assert(dense < world.count);
+	const auto slot = world.slot_of_dense[dense];
+	return { slot, world.generations[slot] };
+}
+
+EntityHandle entity_create(EntityWorld& world)
+{
+	if (!world.free_count)
+		return {};
+
+	const auto slot = world.free_slots[--world.free_count];
+	const auto dense = world.count++;
+	world.dense_of_slot[slot] = dense;
+	world.slot_of_dense[dense] = slot;
+
+	world.pos_x[dense] = 0;
+	world.pos_y[dense] = 0;
+	world.prev_x[dense] = 0;
+	world.prev_y[dense] = 0;
+	world.vel_x[dense] = 0;
+	world.vel_y[dense] = 0;
+	world.radius[dense] = 0;
+	world.color[dense] = 0;
+
+	return { slot, world.generations[slot] };
+}
+
+void entity_destroy(EntityWorld& world, const EntityHandle handle)
+{
+	if (!entity_is_alive(world, handle))
+		return;
+
+	const auto dense = world.dense_of_slot[handle.slot];
+	const auto last = --world.count;
+	if (dense != last) {
+		world.pos_x[dense] = world.pos_x[last];
+		world.pos_y[dense] = world.pos_y[last];
+		world.prev_x[dense] = world.prev_x[last];
+		world.prev_y[dense] = world.prev_y[last];
+		world.vel_x[dense] = world.vel_x[last];
+		world.vel_y[dense] = world.vel_y[last];
+		world.radius[dense] = world.radius[last];
+		world.color[dense] = world.color[last];
+
+		const auto moved_slot = world.slot_of_dense[last];
+		world.slot_of_dense[dense] = moved_slot;
+		world.dense_of_slot[moved_slot] = dense;
+	}
+
+	world.dense_of_slot[handle.slot] = invalid_dense_index;
+	world.generations[handle.slot]++;
+	if (!world.generations[handle.slot])
+		world.generations[handle.slot] = 1;
+	world.free_slots[world.free_count++] = handle.slot;
+}
+
+// Systems, written as straight loops over the dense arrays so the compiler can vectorize them
+
+void entity_integrate(EntityWorld& world, const float dt, const u32 begin, const u32 end)
+{
+	float* __restrict pos_x = world.pos_x;
+	float* __restrict pos_y = world.pos_y;
+	float* __restrict prev_x = world.prev_x;
+	float* __restrict prev_y = world.prev_y;
+	const float* __restrict vel_x = world.vel_x;
+	const float* __restrict vel_y = world.vel_y;
+
+	for (u32 i = begin; i < end; i++) {
+		prev_x[i] = pos_x[i];
+		prev_y[i] = pos_y[i];
+		pos_x[i] += vel_x[i] * dt;
+		pos_y[i] += vel_y[i] * dt;
+	}
+}
+
+void entity_bounce_in_bounds(EntityWorld& world, const float min_x, const float min_y, const float max_x, const float max_y)
+{
+	const auto count = world.count;
+	const float* __restrict pos_x = world.pos_x;
+	const float* __restrict pos_y = world.pos_y;
+	float* __restrict vel_x = world.vel_x;
+	float* __restrict vel_y = world.vel_y;
+
+	for (u32 i = 0; i < count; i++) {
+		const auto vx = vel_x[i];
+		const auto vy = vel_y[i];
+		const auto abs_vx = vx < 0 ? -vx : vx;
+		const auto abs_vy = vy < 0 ? -vy : vy;
+		vel_x[i] = pos_x[i] < min_x ? abs_vx : (pos_x[i] > max_x ? -abs_vx : vx);
+		vel_y[i] = pos_y[i] < min_y ? abs_vy : (pos_y[i] > max_y ? -abs_vy : vy);
+	}
+}
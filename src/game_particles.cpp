@@ -0,0 +1,209 @@
+#include <emmintrin.h>
+
+#include "game.h"
+#include "memory_arena.h"
+#include "simd.h"
+#include "types.h"
+
+// Particles are plain struct-of-arrays with no handles: nothing refers to a particle, so dead ones are dropped by
+// compacting the live ones to the front. The update runs in batches on the job threads, each batch packs its own
+// survivors to the front of its range and a serial pass then closes the gaps between batches, so every step
+// costs in proportion to the live count.
+
+const u32 max_particle_count = 1 << 18;
+const u32 particle_job_batch_size = 8192; // Multiple of 8, batches start on AVX boundaries
+const auto particle_gravity = 240.f; // Pixels per second squared
+
+struct ParticleSystem {
+	u32 capacity;
+	u32 count;
+	bool use_avx2;
+
+	// Indexed by particle, all cache line aligned
+	float* pos_x;
+	float* pos_y;
+	float* prev_x;
+	float* prev_y;
+	float* vel_x;
+	float* vel_y;
+	float* life; // Seconds left, dead at or below 0
+	u32* color; // Full brightness, fades out with life
+
+	u32* batch_alive; // Survivors of each batch in the last update
+	u32* compact_lanes; // 256 masks * 8 lanes, for every live-lane mask the lanes to keep, packed to the front
+};
+
+bool particle_system_init(ParticleSystem& particles, MemoryArena& arena, const u32 capacity)
+{
+	particles = {};
+	particles.capacity = capacity;
+	particles.use_avx2 = cpu_has_avx2();
+
+	particles.pos_x = arena_push_array<float>(arena, capacity);
+	particles.pos_y = arena_push_array<float>(arena, capacity);
+	particles.prev_x = arena_push_array<float>(arena, capacity);
+	particles.prev_y = arena_push_array<float>(arena, capacity);
+	particles.vel_x = arena_push_array<float>(arena, capacity);
+	particles.vel_y = arena_push_array<float>(arena, capacity);
+	particles.life = arena_push_array<float>(arena, capacity);
+	particles.color = arena_push_array<u32>(arena, capacity);
+	particles.batch_alive = arena_push_array<u32>(arena, (capacity + particle_job_batch_size - 1) / particle_job_batch_size);
+	particles.compact_lanes = arena_push_array<u32>(arena, 256 * 8);
+
+	if (!particles.compact_lanes)
+		return false;
+
+	for (u32 mask = 0; mask < 256; mask++) {
+		auto lanes = particles.compact_lanes + mask * 8;
+		u32 kept = 0;
+		for (u32 lane = 0; lane < 8; lane++) {
+			if (mask & (1 << lane))
+				lanes[kept++] = lane;
+		}
+		while (kept < 8)
+			lanes[kept++] = 0; // Written past the new end and overwritten by the next group
+	}
+
+	return true;
+}
+
+// Returns the new particle's index, or capacity when full
+u32 particle_add(ParticleSystem& particles)
+{
+	if (particles.count == particles.capacity)
+		return particles.capacity;
+	return particles.count++;
+}
+
+// Every particle is written at the current write index and the index only advances for live ones
+u32 particle_update_range(ParticleSystem& particles, const float dt, const u32 begin, const u32 end, u32 write)
+{
+	float* __restrict pos_x = particles.pos_x;
+	float* __restrict pos_y = particles.pos_y;
+	float* __restrict prev_x = particles.prev_x;
+	float* __restrict prev_y = particles.prev_y;
+	float* __restrict vel_x = particles.vel_x;
+	float* __restrict vel_y = particles.vel_y;
+	float* __restrict life = particles.life;
+	u32* __restrict color = particles.color;
+
+	for (u32 i = begin; i < end; i++) {
+		const auto x = pos_x[i];
+		const auto y = pos_y[i];
+		const auto vx = vel_x[i];
+		const auto vy = vel_y[i] + particle_gravity * dt;
+		const auto c = color[i];
+		const auto l = life[i] - dt;
+
+		prev_x[write] = x;
+		prev_y[write] = y;
+		pos_x[write] = x + vx * dt;
+		pos_y[write] = y + vy * dt;
+		vel_x[write] = vx;
+		vel_y[write] = vy;
+		life[write] = l;
+		color[write] = c;
+		write += l > 0.f;
+	}
+	return write;
+}
+
+__attribute__((target("avx2"))) u32 particle_update_range_avx2(ParticleSystem& particles, const float dt, const u32 begin, const u32 end)
+{
+	const auto dt8 = _mm256_set1_ps(dt);
+	const auto gravity8 = _mm256_set1_ps(particle_gravity * dt);
+	const auto zero = _mm256_setzero_ps();
+
+	// Stores of a packed group reach at most 7 lanes past the write index, which never passes the group being read
+	auto write = begin;
+	u32 i = begin;
+	for (; i + 8 <= end; i += 8) {
+		const auto x = _mm256_load_ps(particles.pos_x + i);
+		const auto y = _mm256_load_ps(particles.pos_y + i);
+		const auto vx = _mm256_load_ps(particles.vel_x + i);
+		const auto vy = _mm256_add_ps(_mm256_load_ps(particles.vel_y + i), gravity8);
+		const auto l = _mm256_sub_ps(_mm256_load_ps(particles.life + i), dt8);
+		const auto c = _mm256_load_si256((const __m256i*)(particles.color + i));
+
+		const auto alive = (u32)_mm256_movemask_ps(_mm256_cmp_ps(l, zero, _CMP_GT_OQ));
+		const auto lanes = _mm256_load_si256((const __m256i*)(particles.compact_lanes + alive * 8));
+
+		_mm256_storeu_ps(particles.prev_x + write, _mm256_permutevar8x32_ps(x, lanes));
+		_mm256_storeu_ps(particles.prev_y + write, _mm256_permutevar8x32_ps(y, lanes));
+		_mm256_storeu_ps(particles.pos_x + write, _mm256_permutevar8x32_ps(_mm256_add_ps(x, _mm256_mul_ps(vx, dt8)), lanes));
+		_mm256_storeu_ps(particles.pos_y + write, _mm256_permutevar8x32_ps(_mm256_add_ps(y, _mm256_mul_ps(vy, dt8)), lanes));
+		_mm256_storeu_ps(particles.vel_x + write, _mm256_permutevar8x32_ps(vx, lanes));
+		_mm256_storeu_ps(particles.vel_y + write, _mm256_permutevar8x32_ps(vy, lanes));
+		_mm256_storeu_ps(particles.life + write, _mm256_permutevar8x32_ps(l, lanes));
+		_mm256_storeu_si256((__m256i*)(particles.color + write), _mm256_permutevar8x32_epi32(c, lanes));
+		write += __builtin_popcount(alive);
+	}
+	return particle_update_range(particles, dt, i, end, write);
+}
+
+struct ParticleJob {
+	ParticleSystem* particles;
+	float dt;
+};
+
+// begin and end count batches, not particles
+void particle_update_job(void* data, u32 begin, u32 end)
+{
+	auto& job = *(ParticleJob*)data;
+	auto& particles = *job.particles;
+	for (auto batch = begin; batch < end; batch++) {
+		const auto first = batch * particle_job_batch_size;
+		const auto last = first + particle_job_batch_size < particles.count ? first + particle_job_batch_size : particles.count;
+		const auto write = particles.use_avx2 ? particle_update_range_avx2(particles, job.dt, first, last)
+											  : particle_update_range(particles, job.dt, first, last, first);
+		particles.batch_alive[batch] = write - first;
+	}
+}
+
+// Moves the survivors of every batch down against the ones of the batch before it
+void particle_close_batch_gaps(ParticleSystem& particles, const u32 batch_count)
+{
+	u32 count = batch_count ? particles.batch_alive[0] : 0;
+	for (u32 batch = 1; batch < batch_count; batch++) {
+		const auto first = batch * particle_job_batch_size;
+		const auto alive = particles.batch_alive[batch];
+		memmove(particles.pos_x + count, particles.pos_x + first, alive * sizeof(float));
+		memmove(particles.pos_y + count, particles.pos_y + first, alive * sizeof(float));
+		memmove(particles.prev_x + count, particles.prev_x + first, alive * sizeof(float));
+		memmove(particles.prev_y + count, particles.prev_y + first, alive * sizeof(float));
+		memmove(particles.vel_x + count, particles.vel_x + first, alive * sizeof(float));
+		memmove(particles.vel_y + count, particles.vel_y + first, alive * sizeof(float));
+		memmove(particles.life + count, particles.life + first, alive * sizeof(float));
+		memmove(particles.color + count, particles.color + first, alive * sizeof(u32));
+		count += alive;
+	}
+	particles.count = count;
+}
+
+u32 particle_saturating_add(const u32 a, const u32 b)
+{
+	return (u32)_mm_cvtsi128_si32(_mm_adds_epu8(_mm_cvtsi32_si128((int)a), _mm_cvtsi32_si128((int)b)));
+}
+
+// Each particle adds its faded colour to one pixel, so overlapping particles glow instead of hiding each other
+template<typename Format>
+void particles_draw(const GameScreenBuffer& buffer, const ParticleSystem& particles, const int camera_x, const int camera_y,
+	const float alpha, const float full_life)
+{
+	const auto pitch = buffer.width * Format::bytes;
+	const auto fade_scale = 256.f / full_life;
+	for (u32 i = 0; i < particles.count; i++) {
+		const auto x = (int)(particles.prev_x[i] + (particles.pos_x[i] - particles.prev_x[i]) * alpha) - camera_x;
+		const auto y = (int)(particles.prev_y[i] + (particles.pos_y[i] - particles.prev_y[i]) * alpha) - camera_y;
+		if ((u32)x >= (u32)buffer.width || (u32)y >= (u32)buffer.height)
+			continue;
+
+		auto fade = (u32)(particles.life[i] * fade_scale);
+		fade = fade > 256 ? 256 : fade;
+		const auto c = particles.color[i];
+		const auto faded = ((((c & 0xFF00FF) * fade) >> 8) & 0xFF00FF) | ((((c & 0x00FF00) * fade) >> 8) & 0x00FF00);
+
+		const auto p = (u8*)buffer.buffer + y * pitch + x * Format::bytes;
+		Format::store(p, Format::pack(particle_saturating_add(Format::unpack(Format::load(p)), faded)));
+	}
+}
@@ -0,0 +1,212 @@
+#include "memory_arena.h"
+#include "types.h"
+#include <math.h>
+
+// Uniform grid hashed into a fixed number of buckets and rebuilt from scratch every update.
+// The build is a counting sort of entries by bucket, split into phases that each work on an
+// independent range (keys, histogram, scatter), so it can be spread over threads.
+// Every entry keeps its exact cell, so bucket collisions never produce duplicate or foreign hits.
+
+struct EntityPair {
+	u32 a, b; // Dense indices, a < b
+};
+
+struct SpatialGrid {
+	float cell_size;
+	float inv_cell_size;
+	u32 bucket_mask;
+	u32 count;
+
+	u32* bucket_start; // bucket_mask + 2 entries, prefix sums of bucket sizes
+	u32* keys; // Bucket of each input index, before sorting
+
+	// Entries sorted by bucket
+	u32* entity;
+	i32* cell_x;
+	i32* cell_y;
+	float* pos_x;
+	float* pos_y;
+};
+
+inline i32 spatial_cell_coord(const SpatialGrid& grid, const float p)
+{
+	return (i32)floorf(p * grid.inv_cell_size);
+}
+
+inline u32 spatial_bucket(const SpatialGrid& grid, const i32 cell_x, const i32 cell_y)
+{
+	return (((u32)cell_x * 73856093u) ^ ((u32)cell_y * 19349663u)) & grid.bucket_mask;
+}
+
+void spatial_grid_compute_keys(SpatialGrid& grid, const float* const pos_x, const float* const pos_y, const u32 begin, const u32 end)
+{
+	for (u32 i = begin; i < end; i++) {
+		grid.keys[i] = spatial_bucket(grid, spatial_cell_coord(grid, pos_x[i]), spatial_cell_coord(grid, pos_y[i]));
+	}
+}
+
+void spatial_grid_count_keys(const SpatialGrid& grid, u32* const histogram, const u32 begin, const u32 end)
+{
+	for (u32 i = begin; i < end; i++) {
+		histogram[grid.keys[i]]++;
+	}
+}
+
+// Turns per-bucket counts in bucket_start into the first index of every bucket
+void spatial_grid_prefix_sum(SpatialGrid& grid)
+{
+	u32 sum = 0;
+	for (u32 bucket = 0; bucket <= grid.bucket_mask + 1; bucket++) {
+		const auto bucket_count = grid.bucket_start[bucket];
+		grid.bucket_start[bucket] = sum;
+		sum += bucket_count;
+	}
+}
+
+// write_cursor holds the next free slot of every bucket, each range needs its own cursor copy
+void spatial_grid_scatter(SpatialGrid& grid, u32* const write_cursor, const float* const pos_x, const float* const pos_y, const u32 begin, const u32 end)
+{
+	for (u32 i = begin; i < end; i++) {
+		const auto dest = write_cursor[grid.keys[i]]++;
+		grid.entity[dest] = i;
+		grid.pos_x[dest] = pos_x[i];
+		grid.pos_y[dest] = pos_y[i];
+		grid.cell_x[dest] = spatial_cell_coord(grid, pos_x[i]);
+		grid.cell_y[dest] = spatial_cell_coord(grid, pos_y[i]);
+	}
+}
+
+bool spatial_grid_init(SpatialGrid& grid, MemoryArena& arena, const u32 count, const float cell_size)
+{
+	u32 bucket_count = 1024;
+	while (bucket_count < 2 * count)
+		bucket_count *= 2;
+
+	grid = {};
+	grid.cell_size = cell_size;
+	grid.inv_cell_size = 1.f / cell_size;
+	grid.bucket_mask = bucket_count - 1;
+	grid.count = count;
+
+	grid.bucket_start = arena_push_array<u32>(arena, bucket_count + 1);
+	grid.keys = arena_push_array<u32>(arena, count);
+	grid.entity = arena_push_array<u32>(arena, count);
+	grid.cell_x = arena_push_array<i32>(arena, count);
+	grid.cell_y = arena_push_array<i32>(arena, count);
+	grid.pos_x = arena_push_array<float>(arena, count);
+	grid.pos_y = arena_push_array<float>(arena, count);
+
+	return grid.pos_y != 0;
+}
+
+// Counting sort of the keys computed by spatial_grid_compute_keys
+bool spatial_grid_sort(SpatialGrid& grid, MemoryArena& arena, const float* const pos_x, const float* const pos_y)
+{
+	const auto bucket_count = grid.bucket_mask + 1;
+	memset(grid.bucket_start, 0, (bucket_count + 1) * sizeof(u32));
+	spatial_grid_count_keys(grid, grid.bucket_start, 0, grid.count);
+	spatial_grid_prefix_sum(grid);
+
+	auto write_cursor = arena_push_array<u32>(arena, bucket_count);
+	if (!write_cursor)
+		return false;
+	memcpy(write_cursor, grid.bucket_start, bucket_count * sizeof(u32));
+	spatial_grid_scatter(grid, write_cursor, pos_x, pos_y, 0, grid.count);
+
+	return true;
+}
+
+bool spatial_grid_build(SpatialGrid& grid, MemoryArena& arena, const float* const pos_x, const float* const pos_y, const u32 count, const float cell_size)
+{
+	if (!spatial_grid_init(grid, arena, count, cell_size))
+		return false;
+
+	spatial_grid_compute_keys(grid, pos_x, pos_y, 0, count);
+	return spatial_grid_sort(grid, arena, pos_x, pos_y);
+}
+
+u32 spatial_query_box(const SpatialGrid& grid, const float min_x, const float min_y, const float max_x, const float max_y, u32* const out, const u32 max_out)
+{
+	u32 found = 0;
+	const auto min_cell_x = spatial_cell_coord(grid, min_x);
+	const auto min_cell_y = spatial_cell_coord(grid, min_y);
+	const auto max_cell_x = spatial_cell_coord(grid, max_x);
+	const auto max_cell_y = spatial_cell_coord(grid, max_y);
+
+	for (auto cell_y = min_cell_y; cell_y <= max_cell_y; cell_y++) {
+		for (auto cell_x = min_cell_x; cell_x <= max_cell_x; cell_x++) {
+			const auto bucket = spatial_bucket(grid, cell_x, cell_y);
+			for (auto e = grid.bucket_start[bucket]; e < grid.bucket_start[bucket + 1]; e++) {
+				if (grid.cell_x[e] != cell_x || grid.cell_y[e] != cell_y)
+					continue;
+				if (grid.pos_x[e] < min_x || grid.pos_x[e] > max_x || grid.pos_y[e] < min_y || grid.pos_y[e] > max_y)
+					continue;
+				if (found == max_out)
+					return found;
+				out[found++] = grid.entity[e];
+			}
+		}
+	}
+	return found;
+}
+
+u32 spatial_query_radius(const SpatialGrid& grid, const float x, const float y, const float radius, u32* const out, const u32 max_out)
+{
+	u32 found = 0;
+	const auto radius_sq = radius * radius;
+	const auto min_cell_x = spatial_cell_coord(grid, x - radius);
+	const auto min_cell_y = spatial_cell_coord(grid, y - radius);
+	const auto max_cell_x = spatial_cell_coord(grid, x + radius);
+	const auto max_cell_y = spatial_cell_coord(grid, y + radius);
+
+	for (auto cell_y = min_cell_y; cell_y <= max_cell_y; cell_y++) {
+		for (auto cell_x = min_cell_x; cell_x <= max_cell_x; cell_x++) {
+			const auto bucket = spatial_bucket(grid, cell_x, cell_y);
+			for (auto e = grid.bucket_start[bucket]; e < grid.bucket_start[bucket + 1]; e++) {
+				if (grid.cell_x[e] != cell_x || grid.cell_y[e] != cell_y)
+					continue;
+				const auto dx = grid.pos_x[e] - x;
+				const auto dy = grid.pos_y[e] - y;
+				if (dx * dx + dy * dy > radius_sq)
+					continue;
+				if (found == max_out)
+					return found;
+				out[found++] = grid.entity[e];
+			}
+		}
+	}
+	return found;
+}
+
+// Emits every pair closer than the sum of their radii, each pair once.
+// cell_size must be at least twice the largest radius so the 3x3 neighbourhood covers every contact.
+u32 spatial_find_pairs(const SpatialGrid& grid, const float* const radius, EntityPair* const out, const u32 max_out)
+{
+	u32 found = 0;
+	for (u32 e = 0; e < grid.count; e++) {
+		const auto a = grid.entity[e];
+		const auto x = grid.pos_x[e];
+		const auto y = grid.pos_y[e];
+
+		for (auto cell_y = grid.cell_y[e] - 1; cell_y <= grid.cell_y[e] + 1; cell_y++) {
+			for (auto cell_x = grid.cell_x[e] - 1; cell_x <= grid.cell_x[e] + 1; cell_x++) {
+				const auto bucket = spatial_bucket(grid, cell_x, cell_y);
+				for (auto other = grid.bucket_start[bucket]; other < grid.bucket_start[bucket + 1]; other++) {
+					const auto b = grid.entity[other];
+					if (b <= a || grid.cell_x[other] != cell_x || grid.cell_y[other] != cell_y)
+						continue;
+
+					const auto dx = grid.pos_x[other] - x;
+					const auto dy = grid.pos_y[other] - y;
+					const auto contact = radius[a] + radius[b];
+					if (dx * dx + dy * dy >= contact * contact)
+						continue;
+					if (found == max_out)
+						return found;
+					out[found++] = { a, b };
+				}
+			}
+		}
+	}
+	return found;
+}
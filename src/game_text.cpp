@@ -0,0 +1,336 @@
+#include <emmintrin.h>
+
+#include "game.h"
+#include "memory_arena.h"
+#include "types.h"
+
+// Bitmap font text. The 8x8 glyphs are expanded once into an atlas of 32-bit masks (all ones where the glyph
+// is set) at the requested scale, so drawing a glyph row is a masked select with no per-pixel branches.
+// Laid out strings are cached by content, so text that doesn't change between frames skips layout entirely.
+
+const auto font_first_char = ' ';
+const auto font_char_count = 95; // Printable ASCII
+const auto font_glyph_dim = 8;
+
+// Rows top to bottom, bit 0 is the leftmost pixel
+const u8 font_glyph_bits[font_char_count][font_glyph_dim] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ' '
+	{ 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 }, // !
+	{ 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+	{ 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 }, // #
+	{ 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 }, // $
+	{ 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 }, // %
+	{ 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 }, // &
+	{ 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+	{ 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 }, // (
+	{ 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 }, // )
+	{ 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 }, // *
+	{ 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 }, // +
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 }, // ,
+	{ 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 }, // -
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 }, // .
+	{ 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 }, // /
+	{ 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 }, // 0
+	{ 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 }, // 1
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 }, // 2
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 }, // 3
+	{ 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 }, // 4
+	{ 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 }, // 5
+	{ 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 }, // 6
+	{ 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 }, // 7
+	{ 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 }, // 8
+	{ 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 }, // 9
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 }, // :
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 }, // ;
+	{ 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 }, // <
+	{ 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 }, // =
+	{ 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 }, // >
+	{ 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 }, // ?
+	{ 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 }, // @
+	{ 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 }, // A
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 }, // B
+	{ 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 }, // C
+	{ 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 }, // D
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 }, // E
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 }, // F
+	{ 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 }, // G
+	{ 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 }, // H
+	{ 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // I
+	{ 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 }, // J
+	{ 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 }, // K
+	{ 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 }, // L
+	{ 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 }, // M
+	{ 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 }, // N
+	{ 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 }, // O
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 }, // P
+	{ 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 }, // Q
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 }, // R
+	{ 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 }, // S
+	{ 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // T
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 }, // U
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 }, // V
+	{ 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 }, // W
+	{ 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 }, // X
+	{ 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 }, // Y
+	{ 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 }, // Z
+	{ 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 }, // [
+	{ 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 }, // backslash
+	{ 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 }, // ]
+	{ 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 }, // ^
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF }, // _
+	{ 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 }, // `
+	{ 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 }, // a
+	{ 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 }, // b
+	{ 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 }, // c
+	{ 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 }, // d
+	{ 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 }, // e
+	{ 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 }, // f
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F }, // g
+	{ 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 }, // h
+	{ 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // i
+	{ 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E }, // j
+	{ 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 }, // k
+	{ 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // l
+	{ 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 }, // m
+	{ 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 }, // n
+	{ 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 }, // o
+	{ 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F }, // p
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 }, // q
+	{ 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 }, // r
+	{ 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 }, // s
+	{ 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 }, // t
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 }, // u
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 }, // v
+	{ 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 }, // w
+	{ 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 }, // x
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F }, // y
+	{ 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 }, // z
+	{ 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 }, // {
+	{ 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 }, // |
+	{ 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 }, // }
+	{ 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ~
+};
+
+const auto max_text_length = 128;
+const auto text_cache_size = 64; // Must be a power of 2
+const auto text_cache_probes = 8;
+
+struct FontAtlas {
+	int glyph_width, glyph_height; // In pixels, glyph_width is a multiple of 4
+	u32* masks; // font_char_count glyphs of glyph_width * glyph_height masks each
+};
+
+// A string with its glyphs already placed, relative to where it's drawn
+struct TextLayout {
+	u64 hash;
+	u32 last_used;
+	u16 length;
+	u16 glyph_count;
+	int width, height;
+	char text[max_text_length];
+	u8 glyph[max_text_length];
+	i16 glyph_x[max_text_length];
+	i16 glyph_y[max_text_length];
+};
+
+struct TextCache {
+	FontAtlas atlas;
+	u32 frame; // Bumped by text_begin_frame, decides what gets evicted
+	u32 layout_count; // Layouts computed so far, a miss counter
+	TextLayout layouts[text_cache_size];
+};
+
+bool font_atlas_init(FontAtlas& atlas, MemoryArena& arena, const int scale)
+{
+	atlas.glyph_width = font_glyph_dim * scale;
+	atlas.glyph_height = font_glyph_dim * scale;
+	const auto glyph_pixels = atlas.glyph_width * atlas.glyph_height;
+	atlas.masks = arena_push_array<u32>(arena, font_char_count * glyph_pixels);
+	if (!atlas.masks)
+		return false;
+
+	for (int c = 0; c < font_char_count; c++) {
+		auto mask = atlas.masks + c * glyph_pixels;
+		for (int y = 0; y < atlas.glyph_height; y++) {
+			const auto bits = font_glyph_bits[c][y / scale];
+			for (int x = 0; x < atlas.glyph_width; x++) {
+				*mask++ = (bits >> (x / scale)) & 1 ? 0xFFFFFFFF : 0;
+			}
+		}
+	}
+	return true;
+}
+
+bool text_cache_init(TextCache& cache, MemoryArena& arena, const int scale)
+{
+	memset((void*)&cache, 0, sizeof(cache));
+	return font_atlas_init(cache.atlas, arena, scale);
+}
+
+void text_begin_frame(TextCache& cache)
+{
+	cache.frame++;
+}
+
+u64 text_hash(const char* const text, u32& length)
+{
+	// FNV-1a
+	u64 hash = 0xCBF29CE484222325ull;
+	length = 0;
+	while (text[length] && length < max_text_length) {
+		hash = (hash ^ (u8)text[length]) * 0x100000001B3ull;
+		length++;
+	}
+	return hash;
+}
+
+void text_layout(TextLayout& layout, const FontAtlas& atlas, const char* const text, const u32 length)
+{
+	layout.length = length;
+	layout.glyph_count = 0;
+	memcpy(layout.text, text, length);
+
+	int x = 0, y = 0;
+	layout.width = 0;
+	layout.height = length ? atlas.glyph_height : 0;
+	for (u32 i = 0; i < length; i++) {
+		const auto c = text[i];
+		if (c == '\n') {
+			x = 0;
+			y += atlas.glyph_height;
+			layout.height = y + atlas.glyph_height;
+			continue;
+		}
+
+		// Blanks and characters outside the font only advance
+		const auto glyph = c - font_first_char;
+		if (glyph > 0 && glyph < font_char_count) {
+			const auto g = layout.glyph_count++;
+			layout.glyph[g] = (u8)glyph;
+			layout.glyph_x[g] = (i16)x;
+			layout.glyph_y[g] = (i16)y;
+		}
+		x += atlas.glyph_width;
+		if (x > layout.width)
+			layout.width = x;
+	}
+}
+
+// Finds the cached layout of text or lays it out into the least recently used slot it could go in
+const TextLayout& text_get_layout(TextCache& cache, const char* const text)
+{
+	u32 length;
+	const auto hash = text_hash(text, length);
+
+	TextLayout* oldest = 0;
+	for (u32 probe = 0; probe < text_cache_probes; probe++) {
+		auto& layout = cache.layouts[(hash + probe) & (text_cache_size - 1)];
+		if (layout.hash == hash && layout.length == length && memcmp(layout.text, text, length) == 0) {
+			layout.last_used = cache.frame;
+			return layout;
+		}
+		if (!oldest || layout.last_used < oldest->last_used)
+			oldest = &layout;
+	}
+
+	oldest->hash = hash;
+	oldest->last_used = cache.frame;
+	text_layout(*oldest, cache.atlas, text, length);
+	cache.layout_count++;
+	return *oldest;
+}
+
+// dst = glyph ? color : dst, 4 pixels at a time for 32-bit, 8 for 16-bit and 16 for indexed, packed 24-bit goes one by one
+template<typename Format>
+void text_blit_glyph(const GameScreenBuffer& buffer, const FontAtlas& atlas, const u32* mask, const int x, const int y, const u32 color)
+{
+	const auto pitch = buffer.width * Format::bytes;
+	const auto packed = Format::pack(color);
+	for (int row = 0; row < atlas.glyph_height; row++) {
+		auto dst = (u8*)buffer.buffer + (y + row) * pitch + x * Format::bytes;
+		if constexpr (Format::bytes == 4) {
+			const auto color4 = _mm_set1_epi32((int)packed);
+			for (int col = 0; col < atlas.glyph_width; col += 4) {
+				const auto m = _mm_loadu_si128((const __m128i*)(mask + col));
+				const auto d = _mm_loadu_si128((const __m128i*)(dst + col * 4));
+				_mm_storeu_si128((__m128i*)(dst + col * 4), _mm_or_si128(_mm_and_si128(m, color4), _mm_andnot_si128(m, d)));
+			}
+		} else if constexpr (Format::bytes == 1) {
+			const auto color16 = _mm_set1_epi8((char)packed);
+			auto col = 0;
+			for (; col + 16 <= atlas.glyph_width; col += 16) {
+				const auto m0 = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(mask + col)), _mm_loadu_si128((const __m128i*)(mask + col + 4)));
+				const auto m1 = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(mask + col + 8)), _mm_loadu_si128((const __m128i*)(mask + col + 12)));
+				const auto m = _mm_packs_epi16(m0, m1);
+				const auto d = _mm_loadu_si128((const __m128i*)(dst + col));
+				_mm_storeu_si128((__m128i*)(dst + col), _mm_or_si128(_mm_and_si128(m, color16), _mm_andnot_si128(m, d)));
+			}
+			for (; col < atlas.glyph_width; col++) {
+				if (mask[col])
+					Format::store(dst + col, packed);
+			}
+		} else if constexpr (Format::bytes == 2) {
+			const auto color8 = _mm_set1_epi16((short)packed);
+			auto col = 0;
+			for (; col + 8 <= atlas.glyph_width; col += 8) {
+				// All-ones or zero masks stay that way through the signed saturation
+				const auto m = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(mask + col)), _mm_loadu_si128((const __m128i*)(mask + col + 4)));
+				const auto d = _mm_loadu_si128((const __m128i*)(dst + col * 2));
+				_mm_storeu_si128((__m128i*)(dst + col * 2), _mm_or_si128(_mm_and_si128(m, color8), _mm_andnot_si128(m, d)));
+			}
+			for (; col < atlas.glyph_width; col++) {
+				if (mask[col])
+					Format::store(dst + col * 2, packed);
+			}
+		} else {
+			for (int col = 0; col < atlas.glyph_width; col++) {
+				if (mask[col])
+					Format::store(dst + col * Format::bytes, packed);
+			}
+		}
+		mask += atlas.glyph_width;
+	}
+}
+
+template<typename Format>
+void text_blit_glyph_clipped(const GameScreenBuffer& buffer, const FontAtlas& atlas, const u32* const mask, const int x, const int y, const u32 color)
+{
+	const auto min_x = x < 0 ? -x : 0;
+	const auto min_y = y < 0 ? -y : 0;
+	const auto max_x = x + atlas.glyph_width > buffer.width ? buffer.width - x : atlas.glyph_width;
+	const auto max_y = y + atlas.glyph_height > buffer.height ? buffer.height - y : atlas.glyph_height;
+
+	const auto pitch = buffer.width * Format::bytes;
+	const auto packed = Format::pack(color);
+	for (int row = min_y; row < max_y; row++) {
+		const auto dst = (u8*)buffer.buffer + (y + row) * pitch + x * Format::bytes;
+		const auto src = mask + row * atlas.glyph_width;
+		for (int col = min_x; col < max_x; col++) {
+			if (src[col])
+				Format::store(dst + col * Format::bytes, packed);
+		}
+	}
+}
+
+// Draws every glyph of the string in one pass over its cached layout, returns the layout for sizing
+template<typename Format>
+const TextLayout& text_draw(TextCache& cache, const GameScreenBuffer& buffer, const int x, const int y, const char* const text, const u32 color)
+{
+	const auto& layout = text_get_layout(cache, text);
+	const auto& atlas = cache.atlas;
+	const auto glyph_pixels = atlas.glyph_width * atlas.glyph_height;
+
+	for (u32 g = 0; g < layout.glyph_count; g++) {
+		const auto gx = x + layout.glyph_x[g];
+		const auto gy = y + layout.glyph_y[g];
+		if (gx >= buffer.width || gy >= buffer.height || gx + atlas.glyph_width <= 0 || gy + atlas.glyph_height <= 0)
+			continue;
+
+		const auto mask = atlas.masks + layout.glyph[g] * glyph_pixels;
+		if (gx >= 0 && gy >= 0 && gx + atlas.glyph_width <= buffer.width && gy + atlas.glyph_height <= buffer.height)
+			text_blit_glyph<Format>(buffer, atlas, mask, gx, gy, color);
+		else
+			text_blit_glyph_clipped<Format>(buffer, atlas, mask, gx, gy, color);
+	}
+	return layout;
+}
@@ -0,0 +1,66 @@
+#include "memory_arena.h"
+#include "types.h"
+
+// Sparse world made of fixed-size chunks, found through a chained hash table keyed by chunk coordinates.
+// Chunks are only allocated (from the permanent arena) the first time a tile inside them is written.
+
+const auto tile_chunk_dim = 16; // Tiles per chunk side, must be a power of 2
+const auto tile_chunk_shift = 4;
+const auto tile_size = 16; // Pixels per tile side
+const auto tile_chunk_hash_count = 4096; // Must be a power of 2
+
+struct TileChunk {
+	i32 chunk_x, chunk_y;
+	TileChunk* next_in_hash;
+	u8 tiles[tile_chunk_dim * tile_chunk_dim]; // 0 is empty
+};
+
+struct TileMap {
+	u32 chunk_count;
+	TileChunk* hash[tile_chunk_hash_count];
+};
+
+inline u32 tile_chunk_hash(const i32 chunk_x, const i32 chunk_y)
+{
+	return ((u32)chunk_x * 7919u + (u32)chunk_y * 104729u) & (tile_chunk_hash_count - 1);
+}
+
+// Pass an arena to create the chunk when it doesn't exist yet
+TileChunk* get_tile_chunk(TileMap& map, const i32 chunk_x, const i32 chunk_y, MemoryArena* const arena = 0)
+{
+	auto& slot = map.hash[tile_chunk_hash(chunk_x, chunk_y)];
+	for (auto chunk = slot; chunk; chunk = chunk->next_in_hash) {
+		if (chunk->chunk_x == chunk_x && chunk->chunk_y == chunk_y)
+			return chunk;
+	}
+
+	if (!arena)
+		return 0;
+
+	auto chunk = arena_push_struct<TileChunk>(*arena, cache_line_size);
+	if (!chunk)
+		return 0;
+
+	chunk->chunk_x = chunk_x;
+	chunk->chunk_y = chunk_y;
+	chunk->next_in_hash = slot;
+	slot = chunk;
+	map.chunk_count++;
+	return chunk;
+}
+
+u8 get_tile(TileMap& map, const i32 tile_x, const i32 tile_y)
+{
+	const auto chunk = get_tile_chunk(map, tile_x >> tile_chunk_shift, tile_y >> tile_chunk_shift);
+	if (!chunk)
+		return 0;
+	return chunk->tiles[(tile_y & (tile_chunk_dim - 1)) * tile_chunk_dim + (tile_x & (tile_chunk_dim - 1))];
+}
+
+void set_tile(TileMap& map, MemoryArena& arena, const i32 tile_x, const i32 tile_y, const u8 value)
+{
+	const auto chunk = get_tile_chunk(map, tile_x >> tile_chunk_shift, tile_y >> tile_chunk_shift, value ? &arena : 0);
+	if (!chunk)
+		return;
+	chunk->tiles[(tile_y & (tile_chunk_dim - 1)) * tile_chunk_dim + (tile_x & (tile_chunk_dim - 1))] = value;
+}
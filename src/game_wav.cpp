@@ -0,0 +1,273 @@
+#include "game.h"
+#include "types.h"
+#include <string.h>
+
+// Streams PCM data from a WAV file through a small ring buffer instead of loading the whole file.
+// Source frames are converted to stereo i16 when they enter the ring and resampled to the output rate when mixed.
+
+const auto wav_ring_frame_count = 16384; // Must be a power of 2
+const auto wav_chunk_frame_count = 2048;
+const auto wav_max_channel_num = 8;
+
+enum WavFormat {
+	WavFormat_PCM = 0x0001,
+	WavFormat_Float = 0x0003,
+	WavFormat_Extensible = 0xFFFE,
+};
+
+struct WavInfo {
+	int format;
+	int channel_num;
+	int frame_rate;
+	int bits_per_sample;
+	int bytes_per_frame;
+	u64 data_offset;
+	u64 frame_count;
+};
+
+struct WavStream {
+	PlatformFile file;
+	WavInfo info;
+	bool is_playing;
+	bool is_looping;
+	float volume;
+
+	u64 frames_read; // Source frames pulled into the ring so far (keeps counting across loops)
+	u64 read_pos; // 32.32 fixed point position in source frames
+
+	i16 ring[wav_ring_frame_count * 2]; // Interleaved stereo
+};
+
+#pragma pack(push, 1)
+struct WavChunkHeader {
+	char id[4];
+	u32 size;
+};
+
+struct WavFmtChunk {
+	u16 format;
+	u16 channel_num;
+	u32 frame_rate;
+	u32 byte_rate;
+	u16 block_align;
+	u16 bits_per_sample;
+	u16 extension_size;
+	u16 valid_bits_per_sample;
+	u32 channel_mask;
+	u16 sub_format;
+};
+#pragma pack(pop)
+
+bool wav_parse_header(const PlatformFile& file, WavInfo& info)
+{
+	info = {};
+
+	char riff[12];
+	if (platform_read_file(file, 0, riff, sizeof(riff)) != sizeof(riff)
+		|| memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+		fprintf(stderr, "[WAV]: Not a RIFF/WAVE file\n");
+		return false;
+	}
+
+	auto has_fmt = false;
+	u64 offset = sizeof(riff);
+	WavChunkHeader chunk;
+	while (platform_read_file(file, offset, &chunk, sizeof(chunk)) == sizeof(chunk)) {
+		offset += sizeof(chunk);
+
+		if (memcmp(chunk.id, "fmt ", 4) == 0) {
+			WavFmtChunk fmt = {};
+			const auto fmt_size = chunk.size < sizeof(fmt) ? chunk.size : sizeof(fmt);
+			if (platform_read_file(file, offset, &fmt, fmt_size) != (i64)fmt_size)
+				return false;
+
+			info.format = fmt.format == WavFormat_Extensible ? fmt.sub_format : fmt.format;
+			info.channel_num = fmt.channel_num;
+			info.frame_rate = fmt.frame_rate;
+			info.bits_per_sample = fmt.bits_per_sample;
+			info.bytes_per_frame = fmt.block_align;
+			has_fmt = true;
+
+		} else if (memcmp(chunk.id, "data", 4) == 0) {
+			if (!has_fmt || !info.bytes_per_frame)
+				return false;
+
+			info.data_offset = offset;
+			auto data_size = (u64)chunk.size;
+			if (info.data_offset + data_size > file.size)
+				data_size = file.size - info.data_offset; // Truncated or still being written
+			info.frame_count = data_size / info.bytes_per_frame;
+			break;
+		}
+
+		offset += chunk.size + (chunk.size & 1); // Chunks are padded to even sizes
+	}
+
+	const auto is_pcm = info.format == WavFormat_PCM
+		&& (info.bits_per_sample == 8 || info.bits_per_sample == 16 || info.bits_per_sample == 24 || info.bits_per_sample == 32);
+	const auto is_float = info.format == WavFormat_Float && info.bits_per_sample == 32;
+	if (!is_pcm && !is_float) {
+		fprintf(stderr, "[WAV]: Unsupported format %i with %i bits\n", info.format, info.bits_per_sample);
+		return false;
+	}
+	if (info.channel_num < 1 || info.channel_num > wav_max_channel_num || info.frame_rate <= 0
+		|| info.bytes_per_frame != info.channel_num * info.bits_per_sample / 8) {
+		fprintf(stderr, "[WAV]: Invalid channel layout\n");
+		return false;
+	}
+	if (!info.frame_count) {
+		fprintf(stderr, "[WAV]: No data chunk\n");
+		return false;
+	}
+
+	return true;
+}
+
+i16 wav_decode_sample(const u8* const src, const WavInfo& info)
+{
+	switch (info.bits_per_sample) {
+	case 8:
+		return (i16)((src[0] - 128) << 8);
+	case 16:
+		return (i16)(src[0] | (src[1] << 8));
+	case 24:
+		return (i16)(src[1] | (src[2] << 8));
+	case 32: {
+		if (info.format == WavFormat_Float) {
+			float value;
+			memcpy(&value, src, sizeof(value));
+			value *= 32767.f;
+			if (value > 32767.f)
+				value = 32767.f;
+			if (value < -32768.f)
+				value = -32768.f;
+			return (i16)value;
+		}
+		return (i16)(src[2] | (src[3] << 8));
+	}
+	}
+	return 0;
+}
+
+// Pulls source frames from the file until the ring is full, never overwriting the frame at read_pos
+void wav_stream_fill(WavStream& stream)
+{
+	const auto& info = stream.info;
+	u8 scratch[wav_chunk_frame_count * wav_max_channel_num * 4];
+
+	for (;;) {
+		const auto read_frame = stream.read_pos >> 32;
+		auto free_frames = wav_ring_frame_count - (stream.frames_read - read_frame);
+		if (!free_frames)
+			break;
+
+		auto file_frame = stream.frames_read % info.frame_count;
+		if (!stream.is_looping && stream.frames_read >= info.frame_count)
+			break;
+
+		auto frames_to_read = info.frame_count - file_frame;
+		if (frames_to_read > free_frames)
+			frames_to_read = free_frames;
+		if (frames_to_read > wav_chunk_frame_count)
+			frames_to_read = wav_chunk_frame_count;
+
+		const auto bytes_to_read = frames_to_read * info.bytes_per_frame;
+		const auto bytes_read = platform_read_file(stream.file, info.data_offset + file_frame * info.bytes_per_frame, scratch, bytes_to_read);
+		if (bytes_read <= 0) {
+			stream.is_playing = false;
+			break;
+		}
+
+		const auto frames = (u64)bytes_read / info.bytes_per_frame;
+		const auto bytes_per_sample = info.bits_per_sample / 8;
+		for (u64 i = 0; i < frames; i++) {
+			const auto src = scratch + i * info.bytes_per_frame;
+			const auto left = wav_decode_sample(src, info);
+			const auto right = info.channel_num > 1 ? wav_decode_sample(src + bytes_per_sample, info) : left;
+
+			const auto ring_index = ((stream.frames_read + i) & (wav_ring_frame_count - 1)) * 2;
+			stream.ring[ring_index] = left;
+			stream.ring[ring_index + 1] = right;
+		}
+		stream.frames_read += frames;
+
+		if (frames < frames_to_read)
+			break;
+	}
+}
+
+bool wav_stream_open(WavStream& stream, const char* const filename)
+{
+	stream.is_playing = false;
+	if (!platform_open_file(filename, stream.file))
+		return false;
+
+	if (!wav_parse_header(stream.file, stream.info)) {
+		platform_close_file(stream.file);
+		return false;
+	}
+
+	stream.frames_read = 0;
+	stream.read_pos = 0;
+	stream.volume = 1.f;
+	stream.is_looping = true;
+	stream.is_playing = true;
+
+	printf("[WAV]: Streaming %s (%i Hz, %i channels, %i bits, %.1fs)\n", filename, stream.info.frame_rate, stream.info.channel_num,
+		stream.info.bits_per_sample, (double)stream.info.frame_count / stream.info.frame_rate);
+
+	wav_stream_fill(stream);
+	return true;
+}
+
+void wav_stream_close(WavStream& stream)
+{
+	platform_close_file(stream.file);
+	stream.is_playing = false;
+}
+
+// Adds the stream on top of whatever is already in the sound buffer
+void wav_stream_mix(WavStream& stream, GameSoundBuffer& sound_buffer)
+{
+	if (!stream.is_playing)
+		return;
+
+	wav_stream_fill(stream);
+
+	const auto step = ((u64)stream.info.frame_rate << 32) / sound_buffer.frame_rate; // 32.32 fixed point source frames per output frame
+	const auto volume = (int)(stream.volume * 256.f);
+	for (int i = 0; i < sound_buffer.frame_count; i++) {
+		auto frame = stream.read_pos >> 32;
+		if (frame + 1 >= stream.frames_read) {
+			wav_stream_fill(stream);
+			// At the end of a non-looping stream the last frame interpolates with itself instead of waiting for a next one
+			const auto is_at_end = !stream.is_looping && stream.frames_read >= stream.info.frame_count;
+			if (frame >= stream.frames_read || (frame + 1 >= stream.frames_read && !is_at_end)) {
+				if (is_at_end)
+					stream.is_playing = false;
+				break;
+			}
+		}
+		const auto next_frame = frame + 1 < stream.frames_read ? frame + 1 : frame;
+
+		const auto frac = (int)((stream.read_pos >> 16) & 0xFFFF);
+		const auto index0 = (frame & (wav_ring_frame_count - 1)) * 2;
+		const auto index1 = (next_frame & (wav_ring_frame_count - 1)) * 2;
+
+		for (int channel = 0; channel < 2; channel++) {
+			const int s0 = stream.ring[index0 + channel];
+			const int s1 = stream.ring[index1 + channel];
+			const auto resampled = s0 + (((s1 - s0) * frac) >> 16);
+
+			auto& out = sound_buffer.sample_buffer[i * sound_buffer.channel_num + channel];
+			auto mixed = out + ((resampled * volume) >> 8);
+			if (mixed > 32767)
+				mixed = 32767;
+			if (mixed < -32768)
+				mixed = -32768;
+			out = (i16)mixed;
+		}
+
+		stream.read_pos += step;
+	}
+}
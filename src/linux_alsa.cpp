@@ -1,5 +1,6 @@
 #include <alsa/asoundlib.h>
 
+#include "linux_log.h"
 #include "types.h"
 
 struct SoundOutput {
@@ -9,6 +10,7 @@ struct SoundOutput {
 	const int length = 1;
 	i16* sample_buffer; // @Volatile_bit_depth
 	snd_pcm_t* handle;
+	u64 underrun_count;
 
 	int frame_count() const { return frame_rate * length; };
 	int bytes_per_frame() const { return (bit_depth / 8) * channel_num; };
@@ -19,7 +21,7 @@ bool alsa_setup(SoundOutput& sound_buffer)
 {
 #define ALSA_CALL(name, ...)                 \
 	if (name(__VA_ARGS__) < 0) {             \
-		printf("[ALSA]: " #name "failed\n"); \
+		LOG_ERROR("[ALSA]: " #name " failed\n"); \
 		return false;                        \
 	}
 
@@ -48,3 +50,61 @@ bool alsa_setup(SoundOutput& sound_buffer)
 
 	return true;
 }
+
+// Keeps the queued audio just above the longest recent gap between two writes.
+// Grows right away when frames get slower, the queue runs nearly dry or an underrun happens,
+// and shrinks slowly once things have been steady for a while.
+// The target only decides how much the platform writes each frame. avail_min stays at ALSA's default of one period,
+// it is the free space that wakes a blocked writer and has nothing to do with how full the queue is kept.
+struct AudioLatency {
+	int target_frames; // How much audio to keep queued after each write
+	int min_frames;
+	int max_frames;
+	float peak_frame_ns; // Decaying maximum of the frame time
+	u64 underrun_count;
+	int hold_frames; // No shrinking until this runs out
+};
+
+void audio_latency_setup(AudioLatency& latency, SoundOutput& sound_output)
+{
+	latency = {};
+	latency.min_frames = sound_output.frame_rate / 200; // 5ms, also the margin kept on top of the slowest frame
+	latency.max_frames = sound_output.frame_count() / 2;
+	latency.target_frames = sound_output.frame_rate / 15; // Start conservative and shrink from there
+	latency.peak_frame_ns = 1e9f / 30.f;
+	latency.underrun_count = sound_output.underrun_count;
+}
+
+void audio_latency_update(AudioLatency& latency, SoundOutput& sound_output, const i64 frame_ns, const snd_pcm_sframes_t delay)
+{
+	const auto hold_after_grow = 300; // Frames
+
+	latency.peak_frame_ns *= 0.995f;
+	if (frame_ns > latency.peak_frame_ns)
+		latency.peak_frame_ns = frame_ns;
+
+	// One worst-case frame of audio plus a margin, so right before each write there is still margin left
+	const auto required = (int)(latency.peak_frame_ns * sound_output.frame_rate / 1e9f) + latency.min_frames;
+
+	if (sound_output.underrun_count != latency.underrun_count) {
+		latency.underrun_count = sound_output.underrun_count;
+		latency.target_frames *= 2;
+		latency.hold_frames = hold_after_grow;
+		LOG_WARN("[ALSA]: Underrun, queueing %.1fms\n", 1000.0 * latency.target_frames / sound_output.frame_rate);
+	} else if (delay < latency.min_frames / 2) {
+		// Close call, the queue almost ran dry before this write
+		latency.target_frames += latency.target_frames / 4;
+		latency.hold_frames = hold_after_grow;
+	} else if (required > latency.target_frames) {
+		latency.target_frames = required;
+	} else if (latency.hold_frames > 0) {
+		latency.hold_frames--;
+	} else {
+		latency.target_frames -= (latency.target_frames - required) / 100 + 1;
+	}
+
+	if (latency.target_frames < required)
+		latency.target_frames = required;
+	if (latency.target_frames > latency.max_frames)
+		latency.target_frames = latency.max_frames;
+}
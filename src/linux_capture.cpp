@@ -0,0 +1,472 @@
+#include <emmintrin.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "game.h"
+#include "types.h"
+
+// Audio/video capture to <name>.y4m and <name>.wav.
+// The main thread only copies each presented frame and sound chunk into rings that were allocated and faulted in
+// up front, a writer thread does the colour conversion (any PixelFormat to BGRX, then BGRX to 4:2:0 YCbCr with SSE2)
+// and all the file IO.
+// Y4M has a fixed frame rate, so the writer resamples the presented frames onto capture_fps by repeating the
+// newest frame at every tick, which keeps the video in step with the audio when the game runs at any other rate.
+
+const auto capture_fps = 60;
+const auto capture_video_slots = 8;
+const auto capture_audio_seconds = 4;
+const char capture_frame_header[] = "FRAME\n";
+const auto capture_frame_header_size = sizeof(capture_frame_header) - 1;
+
+struct CaptureSlot {
+	i64 present_ns;
+	PixelFormat format;
+	u32 palette[256]; // PixelFormat_Indexed8 only, as it was when the frame was presented
+};
+
+struct Capture {
+	bool is_active;
+	bool is_stopping;
+	int width, height; // Of the captured frames, even
+	int source_width, source_height;
+	int frame_rate;
+	int channel_num;
+
+	int video_fd;
+	int audio_fd;
+	pthread_t writer;
+	sem_t wake;
+
+	// Single producer (main thread) single consumer (writer) rings, the counts only ever grow
+	u64 frame_bytes;
+	u8* frames;
+	CaptureSlot slots[capture_video_slots];
+	u64 frames_written;
+	u64 frames_read;
+
+	i16* samples;
+	u64 sample_capacity; // In frames
+	u64 samples_written;
+	u64 samples_read;
+
+	u64 dropped_frames;
+	u64 dropped_samples;
+
+	// Writer thread only
+	u8* bgrx; // Frames in other formats get expanded into this first
+	u8* yuv; // capture_frame_header followed by the Y, Cb and Cr planes
+	u64 yuv_bytes;
+	i64 next_tick_ns;
+	bool has_frame;
+	u64 video_frames_out;
+	u64 audio_bytes_out;
+};
+
+void* capture_map(const u64 size)
+{
+	// Faulted in now so the first frames of the capture don't take page faults on the main thread
+	auto result = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	return result == MAP_FAILED ? 0 : result;
+}
+
+bool capture_write_all(const int fd, const void* const data, const u64 size)
+{
+	u64 total_written = 0;
+	while (total_written < size) {
+		const auto bytes_written = write(fd, (const u8*)data + total_written, size - total_written);
+		if (bytes_written < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "[CAPTURE]: Failed to write: %s\n", strerror(errno));
+			return false;
+		}
+		total_written += bytes_written;
+	}
+	return true;
+}
+
+// 44 byte PCM header, the sizes are patched in by capture_close
+bool capture_write_wav_header(Capture& capture, const u32 data_size)
+{
+	const u16 bits = 16; // @Volatile_bit_depth
+	const u16 block_align = capture.channel_num * bits / 8;
+	const u32 byte_rate = capture.frame_rate * block_align;
+	const u32 riff_size = 36 + data_size;
+	const u32 fmt_size = 16;
+	const u16 format = 1; // PCM
+	const u16 channels = capture.channel_num;
+	const u32 rate = capture.frame_rate;
+
+	u8 header[44];
+	memcpy(header, "RIFF", 4);
+	memcpy(header + 4, &riff_size, 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	memcpy(header + 16, &fmt_size, 4);
+	memcpy(header + 20, &format, 2);
+	memcpy(header + 22, &channels, 2);
+	memcpy(header + 24, &rate, 4);
+	memcpy(header + 28, &byte_rate, 4);
+	memcpy(header + 32, &block_align, 2);
+	memcpy(header + 34, &bits, 2);
+	memcpy(header + 36, "data", 4);
+	memcpy(header + 40, &data_size, 4);
+
+	return pwrite(capture.audio_fd, header, sizeof(header), 0) == sizeof(header);
+}
+
+// Full range BT.601, the same coefficients in both paths so the SIMD output matches the scalar one exactly
+inline u8 capture_luma(const u32 b, const u32 g, const u32 r)
+{
+	return (u8)((29 * b + 150 * g + 77 * r + 128) >> 8);
+}
+
+inline u8 capture_saturate(const i32 value)
+{
+	return (u8)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+inline void capture_chroma(const i32 b, const i32 g, const i32 r, u8& cb, u8& cr)
+{
+	cb = capture_saturate(((128 * b - 85 * g - 43 * r + 128) >> 8) + 128);
+	cr = capture_saturate(((-21 * b - 107 * g + 128 * r + 128) >> 8) + 128);
+}
+
+void capture_convert_rows(const Capture& capture, const u8* const src, const int src_pitch, const int min_x, const int y, u8* const luma, u8* const cb, u8* const cr)
+{
+	const auto row0 = src + y * src_pitch;
+	const auto row1 = row0 + src_pitch;
+	for (int x = min_x; x < capture.width; x += 2) {
+		const auto p00 = row0 + x * 4;
+		const auto p01 = p00 + 4;
+		const auto p10 = row1 + x * 4;
+		const auto p11 = p10 + 4;
+		luma[y * capture.width + x] = capture_luma(p00[0], p00[1], p00[2]);
+		luma[y * capture.width + x + 1] = capture_luma(p01[0], p01[1], p01[2]);
+		luma[(y + 1) * capture.width + x] = capture_luma(p10[0], p10[1], p10[2]);
+		luma[(y + 1) * capture.width + x + 1] = capture_luma(p11[0], p11[1], p11[2]);
+
+		// Rounded the same way as two rounds of _mm_avg_epu8
+		u8 avg[3];
+		for (int c = 0; c < 3; c++) {
+			const auto left = (p00[c] + p10[c] + 1) >> 1;
+			const auto right = (p01[c] + p11[c] + 1) >> 1;
+			avg[c] = (u8)((left + right + 1) >> 1);
+		}
+		const auto chroma_index = (y / 2) * (capture.width / 2) + x / 2;
+		capture_chroma(avg[0], avg[1], avg[2], cb[chroma_index], cr[chroma_index]);
+	}
+}
+
+// Luma of 4 BGRX pixels as 32-bit lanes
+inline __m128i capture_luma4(const __m128i pixels)
+{
+	const auto zero = _mm_setzero_si128();
+	const auto coefficients = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+	const auto lo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients); // b0+g0, r0, b1+g1, r1
+	const auto hi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients);
+	const auto even = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+	const auto odd = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), _mm_set1_epi32(128)), 8);
+}
+
+// Sum of each pixel's two 16-bit products, for the 2 pixels of lo and 2 of hi
+inline __m128i capture_dot4(const __m128i lo, const __m128i hi, const __m128i coefficients)
+{
+	const auto a = _mm_madd_epi16(lo, coefficients);
+	const auto b = _mm_madd_epi16(hi, coefficients);
+	const auto even = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+	const auto odd = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_add_epi32(even, odd);
+}
+
+// 8 pixels from each of two rows per step, the scalar path picks up the tail
+void capture_convert_frame(const Capture& capture, const u8* const src, u8* const luma, u8* const cb, u8* const cr)
+{
+	const auto src_pitch = capture.source_width * 4;
+	const auto zero = _mm_setzero_si128();
+	const auto round = _mm_set1_epi32(128);
+	const auto cb_coefficients = _mm_setr_epi16(128, -85, -43, 0, 128, -85, -43, 0);
+	const auto cr_coefficients = _mm_setr_epi16(-21, -107, 128, 0, -21, -107, 128, 0);
+	const auto simd_width = capture.width & ~7;
+
+	for (int y = 0; y < capture.height; y += 2) {
+		const auto row0 = src + y * src_pitch;
+		const auto row1 = row0 + src_pitch;
+		auto luma0 = luma + y * capture.width;
+		auto luma1 = luma0 + capture.width;
+		auto cb_row = cb + (y / 2) * (capture.width / 2);
+		auto cr_row = cr + (y / 2) * (capture.width / 2);
+
+		for (int x = 0; x < simd_width; x += 8) {
+			const auto a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 4));
+			const auto b0 = _mm_loadu_si128((const __m128i*)(row0 + x * 4 + 16));
+			const auto a1 = _mm_loadu_si128((const __m128i*)(row1 + x * 4));
+			const auto b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 4 + 16));
+
+			const auto y0 = _mm_packs_epi32(capture_luma4(a0), capture_luma4(b0));
+			const auto y1 = _mm_packs_epi32(capture_luma4(a1), capture_luma4(b1));
+			_mm_storel_epi64((__m128i*)(luma0 + x), _mm_packus_epi16(y0, y0));
+			_mm_storel_epi64((__m128i*)(luma1 + x), _mm_packus_epi16(y1, y1));
+
+			// Average vertically, then each pixel with its right neighbour, the even pixels hold the 2x2 averages
+			const auto va = _mm_avg_epu8(a0, a1);
+			const auto vb = _mm_avg_epu8(b0, b1);
+			const auto ha = _mm_avg_epu8(va, _mm_srli_si128(va, 4));
+			const auto hb = _mm_avg_epu8(vb, _mm_srli_si128(vb, 4));
+			// Pack the even pixels together: ha0 ha2 hb0 hb2
+			const auto packed = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(ha), _mm_castsi128_ps(hb), _MM_SHUFFLE(2, 0, 2, 0)));
+			const auto lo = _mm_unpacklo_epi8(packed, zero);
+			const auto hi = _mm_unpackhi_epi8(packed, zero);
+
+			const auto bias = _mm_set1_epi32(128);
+			const auto cb4 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(capture_dot4(lo, hi, cb_coefficients), round), 8), bias);
+			const auto cr4 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(capture_dot4(lo, hi, cr_coefficients), round), 8), bias);
+			const auto cb8 = _mm_packs_epi32(cb4, cb4);
+			const auto cr8 = _mm_packs_epi32(cr4, cr4);
+			const auto cb_bytes = _mm_cvtsi128_si32(_mm_packus_epi16(cb8, cb8));
+			const auto cr_bytes = _mm_cvtsi128_si32(_mm_packus_epi16(cr8, cr8));
+			memcpy(cb_row + x / 2, &cb_bytes, 4);
+			memcpy(cr_row + x / 2, &cr_bytes, 4);
+		}
+		capture_convert_rows(capture, src, src_pitch, simd_width, y, luma, cb, cr);
+	}
+}
+
+template<typename Format>
+void capture_expand_pixels(const u8* const src, u32* const dst, const u64 count)
+{
+	for (u64 i = 0; i < count; i++) {
+		dst[i] = Format::unpack(Format::load(src + i * Format::bytes));
+	}
+}
+
+// Returns the frame as BGRX, src itself when it already is
+const u8* capture_to_bgrx(Capture& capture, const CaptureSlot& slot, const u8* const src)
+{
+	const auto count = (u64)capture.source_width * capture.source_height;
+	const auto dst = (u32*)capture.bgrx;
+	switch (slot.format) {
+	case PixelFormat_BGRX32:
+		return src;
+	case PixelFormat_BGR24:
+		capture_expand_pixels<PixelBGR24>(src, dst, count);
+		break;
+	case PixelFormat_RGB565:
+		capture_expand_pixels<PixelRGB565>(src, dst, count);
+		break;
+	case PixelFormat_Indexed8:
+		for (u64 i = 0; i < count; i++) {
+			dst[i] = slot.palette[src[i]];
+		}
+		break;
+	}
+	return capture.bgrx;
+}
+
+void capture_write_frame(Capture& capture)
+{
+	if (capture_write_all(capture.video_fd, capture.yuv, capture.yuv_bytes))
+		capture.video_frames_out++;
+}
+
+// Every tick before present_ns still shows the previous frame
+void capture_advance_ticks(Capture& capture, const i64 present_ns)
+{
+	const i64 tick_ns = 1000000000 / capture_fps;
+	while (capture.has_frame && capture.next_tick_ns < present_ns) {
+		capture_write_frame(capture);
+		capture.next_tick_ns += tick_ns;
+	}
+}
+
+void capture_drain(Capture& capture)
+{
+	const auto samples_written = __atomic_load_n(&capture.samples_written, __ATOMIC_ACQUIRE);
+	while (capture.samples_read < samples_written) {
+		const auto start = capture.samples_read % capture.sample_capacity;
+		auto count = samples_written - capture.samples_read;
+		if (start + count > capture.sample_capacity)
+			count = capture.sample_capacity - start;
+
+		const auto bytes = count * capture.channel_num * sizeof(i16);
+		if (capture_write_all(capture.audio_fd, capture.samples + start * capture.channel_num, bytes))
+			capture.audio_bytes_out += bytes;
+		__atomic_store_n(&capture.samples_read, capture.samples_read + count, __ATOMIC_RELEASE);
+	}
+
+	const auto frames_written = __atomic_load_n(&capture.frames_written, __ATOMIC_ACQUIRE);
+	while (capture.frames_read < frames_written) {
+		const auto slot = capture.frames_read % capture_video_slots;
+		const auto present_ns = capture.slots[slot].present_ns;
+		if (!capture.has_frame)
+			capture.next_tick_ns = present_ns;
+		capture_advance_ticks(capture, present_ns);
+
+		const auto luma = capture.yuv + capture_frame_header_size;
+		const auto cb = luma + capture.width * capture.height;
+		const auto cr = cb + capture.width * capture.height / 4;
+		capture_convert_frame(capture, capture_to_bgrx(capture, capture.slots[slot], capture.frames + slot * capture.frame_bytes), luma, cb, cr);
+		capture.has_frame = true;
+		__atomic_store_n(&capture.frames_read, capture.frames_read + 1, __ATOMIC_RELEASE);
+	}
+}
+
+void* capture_writer_proc(void* param)
+{
+	auto& capture = *(Capture*)param;
+	while (!__atomic_load_n(&capture.is_stopping, __ATOMIC_ACQUIRE)) {
+		sem_wait(&capture.wake);
+		capture_drain(capture);
+	}
+	capture_drain(capture);
+
+	// The newest frame is still on screen, give it its own tick
+	if (capture.has_frame)
+		capture_write_frame(capture);
+	return 0;
+}
+
+// Closes and unmaps whatever capture_setup got to before failing
+void capture_release(Capture& capture)
+{
+	if (capture.video_fd >= 0)
+		close(capture.video_fd);
+	if (capture.audio_fd >= 0)
+		close(capture.audio_fd);
+	if (capture.frames)
+		munmap(capture.frames, capture.frame_bytes * capture_video_slots);
+	if (capture.samples)
+		munmap(capture.samples, capture.sample_capacity * capture.channel_num * sizeof(i16));
+	if (capture.bgrx)
+		munmap(capture.bgrx, (u64)capture.source_width * capture.source_height * 4);
+	if (capture.yuv)
+		munmap(capture.yuv, capture.yuv_bytes);
+	capture = {};
+}
+
+// width and height are those of the GameScreenBuffer that will be captured, in any PixelFormat
+bool capture_setup(Capture& capture, const char* const name, const int width, const int height, const int frame_rate, const int channel_num)
+{
+	capture = {};
+	capture.source_width = width;
+	capture.source_height = height;
+	capture.width = width & ~1; // 4:2:0 needs whole 2x2 blocks, an odd last row or column is cropped
+	capture.height = height & ~1;
+	capture.frame_rate = frame_rate;
+	capture.channel_num = channel_num;
+	capture.video_fd = capture.audio_fd = -1;
+
+	char filename[256];
+	snprintf(filename, sizeof(filename), "%s.y4m", name);
+	capture.video_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	snprintf(filename, sizeof(filename), "%s.wav", name);
+	capture.audio_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (capture.video_fd < 0 || capture.audio_fd < 0) {
+		fprintf(stderr, "[CAPTURE]: Failed to create %s.y4m/.wav: %s\n", name, strerror(errno));
+		capture_release(capture);
+		return false;
+	}
+
+	capture.frame_bytes = (u64)width * height * 4; // Room for the widest format
+	capture.frames = (u8*)capture_map(capture.frame_bytes * capture_video_slots);
+	capture.sample_capacity = (u64)frame_rate * capture_audio_seconds;
+	capture.samples = (i16*)capture_map(capture.sample_capacity * channel_num * sizeof(i16));
+	capture.yuv_bytes = capture_frame_header_size + (u64)capture.width * capture.height * 3 / 2;
+	capture.bgrx = (u8*)capture_map(capture.frame_bytes);
+	capture.yuv = (u8*)capture_map(capture.yuv_bytes);
+	if (!capture.frames || !capture.samples || !capture.bgrx || !capture.yuv) {
+		fprintf(stderr, "[CAPTURE]: Failed to allocate the capture rings: %s\n", strerror(errno));
+		capture_release(capture);
+		return false;
+	}
+	memcpy(capture.yuv, capture_frame_header, capture_frame_header_size);
+
+	char header[128];
+	const auto header_size = snprintf(header, sizeof(header), "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C420jpeg\n", capture.width, capture.height, capture_fps);
+	if (!capture_write_all(capture.video_fd, header, header_size) || !capture_write_wav_header(capture, 0)
+		|| lseek(capture.audio_fd, 44, SEEK_SET) < 0) {
+		capture_release(capture);
+		return false;
+	}
+
+	sem_init(&capture.wake, 0, 0);
+	if (pthread_create(&capture.writer, 0, capture_writer_proc, &capture) != 0) {
+		fprintf(stderr, "[CAPTURE]: Failed to create the writer thread\n");
+		sem_destroy(&capture.wake);
+		capture_release(capture);
+		return false;
+	}
+
+	capture.is_active = true;
+	printf("[CAPTURE]: Writing %ix%i@%i to %s.y4m and %s.wav\n", capture.width, capture.height, capture_fps, name, name);
+	return true;
+}
+
+// Main thread, present_ns is when the frame went to the screen
+void capture_video(Capture& capture, const GameScreenBuffer& buffer, const i64 present_ns)
+{
+	if (!capture.is_active)
+		return;
+	if (buffer.width != capture.source_width || buffer.height != capture.source_height) {
+		capture.dropped_frames++;
+		return;
+	}
+
+	const auto frames_read = __atomic_load_n(&capture.frames_read, __ATOMIC_ACQUIRE);
+	if (capture.frames_written - frames_read == capture_video_slots) {
+		capture.dropped_frames++; // The writer fills the gap by repeating the previous frame
+		return;
+	}
+
+	const auto slot = capture.frames_written % capture_video_slots;
+	auto& capture_slot = capture.slots[slot];
+	memcpy(capture.frames + slot * capture.frame_bytes, buffer.buffer, (u64)buffer.pitch() * buffer.height);
+	capture_slot.present_ns = present_ns;
+	capture_slot.format = buffer.format;
+	if (buffer.format == PixelFormat_Indexed8)
+		memcpy(capture_slot.palette, buffer.palette, sizeof(capture_slot.palette));
+	__atomic_store_n(&capture.frames_written, capture.frames_written + 1, __ATOMIC_RELEASE);
+	sem_post(&capture.wake);
+}
+
+// Main thread, the same interleaved samples that were handed to ALSA
+void capture_audio(Capture& capture, const i16* const samples, const u64 frame_count)
+{
+	if (!capture.is_active)
+		return;
+
+	const auto samples_read = __atomic_load_n(&capture.samples_read, __ATOMIC_ACQUIRE);
+	if (capture.samples_written + frame_count - samples_read > capture.sample_capacity) {
+		capture.dropped_samples += frame_count;
+		return;
+	}
+
+	const auto start = capture.samples_written % capture.sample_capacity;
+	const auto first = start + frame_count > capture.sample_capacity ? capture.sample_capacity - start : frame_count;
+	memcpy(capture.samples + start * capture.channel_num, samples, first * capture.channel_num * sizeof(i16));
+	memcpy(capture.samples, samples + first * capture.channel_num, (frame_count - first) * capture.channel_num * sizeof(i16));
+	__atomic_store_n(&capture.samples_written, capture.samples_written + frame_count, __ATOMIC_RELEASE);
+	sem_post(&capture.wake);
+}
+
+void capture_close(Capture& capture)
+{
+	if (!capture.is_active)
+		return;
+
+	__atomic_store_n(&capture.is_stopping, true, __ATOMIC_RELEASE);
+	sem_post(&capture.wake);
+	pthread_join(capture.writer, 0);
+	sem_destroy(&capture.wake);
+
+	capture_write_wav_header(capture, (u32)capture.audio_bytes_out);
+	printf("[CAPTURE]: %lu video frames, %.1fs of audio, dropped %lu frames and %lu samples\n", capture.video_frames_out,
+		(double)capture.audio_bytes_out / (capture.frame_rate * capture.channel_num * sizeof(i16)), capture.dropped_frames, capture.dropped_samples);
+	capture_release(capture);
+}
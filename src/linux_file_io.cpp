@@ -47,3 +47,48 @@ bool platform_write_entire_file(const char* const filename, void* const mem, con
 
 	return write(fd, mem, mem_size) == mem_size;
 }
+
+// For optional files, so their absence doesn't get logged as a failure
+bool platform_file_exists(const char* const filename)
+{
+	return access(filename, R_OK) == 0;
+}
+
+bool platform_open_file(const char* const filename, PlatformFile& file)
+{
+	file = {};
+	file.handle = open(filename, O_RDONLY);
+	if (file.handle < 0) {
+		fprintf(stderr, "[IO]: Failed to open file: %s\n", strerror(errno));
+		file.handle = 0;
+		return false;
+	}
+
+	file.size = platform_get_file_size(file.handle);
+	return true;
+}
+
+i64 platform_read_file(const PlatformFile& file, const u64 offset, void* const dest, const u64 size)
+{
+	u64 total_read = 0;
+	while (total_read < size) {
+		const auto bytes_read = pread(file.handle, (u8*)dest + total_read, size - total_read, offset + total_read);
+		if (bytes_read < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "[IO]: Failed to read file: %s\n", strerror(errno));
+			return -1;
+		}
+		if (bytes_read == 0)
+			break;
+		total_read += bytes_read;
+	}
+	return total_read;
+}
+
+void platform_close_file(PlatformFile& file)
+{
+	if (file.handle)
+		close(file.handle);
+	file = {};
+}
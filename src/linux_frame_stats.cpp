@@ -0,0 +1,179 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "types.h"
+
+// Records every frame duration into a log-bucketed histogram (32 buckets per power of two, so percentiles are
+// within ~3%), keeps the worst frames with a per-stage breakdown, and the raw durations for offline analysis.
+
+enum FrameStage {
+	FrameStage_Input,
+	FrameStage_Game,
+	FrameStage_Audio,
+	FrameStage_Present,
+	FrameStage_Count,
+};
+
+const char* const frame_stage_names[FrameStage_Count] = { "input", "game", "audio", "present" };
+
+const auto frame_stats_sub_bucket_bits = 5;
+const auto frame_stats_bucket_count = 64 << frame_stats_sub_bucket_bits;
+const auto frame_stats_worst_count = 32;
+const u64 frame_stats_max_raw_frames = 1 << 24;
+const u32 frame_stats_magic = 0x534D5246; // "FRMS"
+const u32 frame_stats_version = 1;
+
+struct WorstFrame {
+	u64 frame_index;
+	i64 frame_ns;
+	i64 stage_ns[FrameStage_Count];
+};
+
+struct FrameStats {
+	u64 frame_count;
+	u64 buckets[frame_stats_bucket_count];
+	WorstFrame worst[frame_stats_worst_count];
+	int best_of_worst; // Index of the smallest entry in worst, the one to replace next
+	u32* raw_ns; // Every frame, saturated to u32
+};
+
+// File written by frame_stats_dump: this header, the buckets, the worst frames, then frame_count u32 durations
+struct FrameStatsFileHeader {
+	u32 magic;
+	u32 version;
+	u32 bucket_count;
+	u32 sub_bucket_bits;
+	u32 worst_count;
+	u32 stage_count;
+	u64 frame_count;
+};
+
+bool frame_stats_setup(FrameStats& stats)
+{
+	stats = {};
+	auto mem = mmap(0, frame_stats_max_raw_frames * sizeof(u32), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "[FRAMES]: Failed to reserve raw frame storage: %s\n", strerror(errno));
+		return false;
+	}
+	stats.raw_ns = (u32*)mem;
+	return true;
+}
+
+int frame_stats_bucket(const u64 ns)
+{
+	if (ns < (1u << frame_stats_sub_bucket_bits))
+		return ns;
+	const auto msb = 63 - __builtin_clzll(ns);
+	const auto sub = (ns >> (msb - frame_stats_sub_bucket_bits)) & ((1 << frame_stats_sub_bucket_bits) - 1);
+	return ((msb - frame_stats_sub_bucket_bits + 1) << frame_stats_sub_bucket_bits) + sub;
+}
+
+// Largest duration that still lands in the bucket
+u64 frame_stats_bucket_limit(const int bucket)
+{
+	if (bucket < (1 << frame_stats_sub_bucket_bits))
+		return bucket;
+	const auto msb = (bucket >> frame_stats_sub_bucket_bits) + frame_stats_sub_bucket_bits - 1;
+	const auto sub = (u64)(bucket & ((1 << frame_stats_sub_bucket_bits) - 1));
+	const auto low = (1ull << msb) | (sub << (msb - frame_stats_sub_bucket_bits));
+	return low + (1ull << (msb - frame_stats_sub_bucket_bits)) - 1;
+}
+
+void frame_stats_record(FrameStats& stats, const i64 frame_ns, const i64* const stage_ns)
+{
+	const auto ns = frame_ns > 0 ? (u64)frame_ns : 0;
+	stats.buckets[frame_stats_bucket(ns)]++;
+	if (stats.raw_ns && stats.frame_count < frame_stats_max_raw_frames)
+		stats.raw_ns[stats.frame_count] = ns > 0xFFFFFFFF ? 0xFFFFFFFF : (u32)ns;
+
+	auto& slot = stats.worst[stats.best_of_worst];
+	if (frame_ns > slot.frame_ns) {
+		slot.frame_index = stats.frame_count;
+		slot.frame_ns = frame_ns;
+		memcpy(slot.stage_ns, stage_ns, sizeof(slot.stage_ns));
+
+		for (int i = 0; i < frame_stats_worst_count; i++) {
+			if (stats.worst[i].frame_ns < stats.worst[stats.best_of_worst].frame_ns)
+				stats.best_of_worst = i;
+		}
+	}
+	stats.frame_count++;
+}
+
+u64 frame_stats_percentile(const FrameStats& stats, const double percentile)
+{
+	const auto target = (u64)(percentile / 100.0 * stats.frame_count);
+	u64 seen = 0;
+	for (int i = 0; i < frame_stats_bucket_count; i++) {
+		seen += stats.buckets[i];
+		if (seen > target)
+			return frame_stats_bucket_limit(i);
+	}
+	return 0;
+}
+
+void frame_stats_report(const FrameStats& stats)
+{
+	if (!stats.frame_count)
+		return;
+
+	printf("[FRAMES]: %lu frames, p50 %.2fms, p90 %.2fms, p99 %.2fms, p99.9 %.2fms\n", stats.frame_count,
+		frame_stats_percentile(stats, 50) / 1e6, frame_stats_percentile(stats, 90) / 1e6,
+		frame_stats_percentile(stats, 99) / 1e6, frame_stats_percentile(stats, 99.9) / 1e6);
+
+	// Worst first, the array itself is unordered
+	bool is_printed[frame_stats_worst_count] = {};
+	for (int n = 0; n < 5; n++) {
+		auto worst = -1;
+		for (int i = 0; i < frame_stats_worst_count; i++) {
+			if (!is_printed[i] && stats.worst[i].frame_ns > 0 && (worst < 0 || stats.worst[i].frame_ns > stats.worst[worst].frame_ns))
+				worst = i;
+		}
+		if (worst < 0)
+			break;
+		is_printed[worst] = true;
+
+		const auto& frame = stats.worst[worst];
+		printf("[FRAMES]: #%lu %.2fms (", frame.frame_index, frame.frame_ns / 1e6);
+		for (int stage = 0; stage < FrameStage_Count; stage++) {
+			printf("%s%s %.2f", stage ? ", " : "", frame_stage_names[stage], frame.stage_ns[stage] / 1e6);
+		}
+		printf(")\n");
+	}
+}
+
+bool frame_stats_dump(const FrameStats& stats, const char* const filename)
+{
+	const auto fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "[FRAMES]: Failed to create %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+
+	const FrameStatsFileHeader header = {
+		.magic = frame_stats_magic,
+		.version = frame_stats_version,
+		.bucket_count = frame_stats_bucket_count,
+		.sub_bucket_bits = frame_stats_sub_bucket_bits,
+		.worst_count = frame_stats_worst_count,
+		.stage_count = FrameStage_Count,
+		.frame_count = stats.frame_count < frame_stats_max_raw_frames ? stats.frame_count : frame_stats_max_raw_frames,
+	};
+
+	auto ok = write(fd, &header, sizeof(header)) == sizeof(header);
+	ok = ok && write(fd, stats.buckets, sizeof(stats.buckets)) == sizeof(stats.buckets);
+	ok = ok && write(fd, stats.worst, sizeof(stats.worst)) == sizeof(stats.worst);
+	const auto raw_size = (i64)(header.frame_count * sizeof(u32));
+	ok = ok && (!stats.raw_ns || write(fd, stats.raw_ns, raw_size) == raw_size);
+	close(fd);
+
+	if (!ok)
+		fprintf(stderr, "[FRAMES]: Failed to write %s\n", filename);
+	else
+		printf("[FRAMES]: Wrote %s\n", filename);
+	return ok;
+}
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+
+// Input-to-photon latency (--latency). Every key and joystick event is tagged with the time its source stamped it
+// and the time we read it, then followed to the first simulation step that consumed it and the present of the frame
+// rendered after that step. The present is synced with the server in this mode, so the last stage ends when the
+// server has finished the put. Scanout and compositor delay come after that and aren't seen from here.
+//
+// Source clocks are in milliseconds and wrap at 32 bits. X server time is normally CLOCK_MONOTONIC, joydev uses
+// jiffies which are offset from it. A source whose first stamp isn't within a second before the read is treated
+// as offset by the smallest read-minus-stamp gap seen so far, which counts the quickest event as polled instantly.
+
+enum InputSource {
+	InputSource_Keyboard, // XKeyEvent.time
+	InputSource_Joystick, // js_event.time
+	InputSource_Count,
+};
+
+const char* const input_source_names[InputSource_Count] = { "keyboard", "joystick" };
+
+enum LatencyStage {
+	LatencyStage_Poll, // Source stamp to our read
+	LatencyStage_Wait, // Read to the start of the update that consumed it
+	LatencyStage_Frame, // That update to the start of present, the rest of the simulation and all of render and audio
+	LatencyStage_Present, // Upscale and put, until the server is done with it
+	LatencyStage_Total,
+	LatencyStage_Count,
+};
+
+const char* const latency_stage_names[LatencyStage_Count] = { "poll", "wait", "frame", "present", "total" };
+
+const auto latency_max_events = 256; // Waiting for an update, more than that in one frame are dropped
+const i64 latency_same_clock_ms = 1000;
+
+struct LatencyEvent {
+	InputSource source;
+	i64 source_ns;
+	i64 read_ns;
+};
+
+struct LatencyHistogram {
+	u64 count;
+	i64 max_ns;
+	u32 buckets[frame_stats_bucket_count]; // Same log buckets as the frame stats
+};
+
+struct SourceClock {
+	bool is_calibrated;
+	bool is_same_clock;
+	i64 offset_ms; // Smallest read-minus-stamp gap seen, used when is_same_clock is false
+};
+
+struct InputLatency {
+	bool is_enabled;
+	SourceClock clocks[InputSource_Count];
+	LatencyHistogram* histograms; // [InputSource_Count][LatencyStage_Count]
+
+	LatencyEvent events[latency_max_events];
+	int event_count;
+	int consumed_count; // Events before this were consumed by an update this frame
+	i64 consumed_ns;
+	u64 dropped_events;
+};
+
+bool input_latency_setup(InputLatency& latency)
+{
+	latency = {};
+	latency.histograms = (LatencyHistogram*)calloc((int)InputSource_Count * (int)LatencyStage_Count, sizeof(LatencyHistogram));
+	if (!latency.histograms) {
+		fprintf(stderr, "[LATENCY]: Failed to allocate the histograms\n");
+		return false;
+	}
+	latency.is_enabled = true;
+	printf("[LATENCY]: Measuring input to present latency\n");
+	return true;
+}
+
+i64 input_latency_source_ns(SourceClock& clock, const u32 source_ms, const i64 read_ns)
+{
+	const auto read_ms = (u32)(read_ns / 1000000);
+	const auto gap_ms = (i64)(i32)(read_ms - source_ms); // Wrap-safe while the two are within 24 days
+	if (!clock.is_calibrated) {
+		clock.is_calibrated = true;
+		clock.is_same_clock = gap_ms >= 0 && gap_ms < latency_same_clock_ms;
+		clock.offset_ms = gap_ms;
+	}
+	if (clock.is_same_clock)
+		return read_ns - gap_ms * 1000000;
+
+	if (gap_ms < clock.offset_ms)
+		clock.offset_ms = gap_ms;
+	return read_ns - (gap_ms - clock.offset_ms) * 1000000;
+}
+
+void input_latency_tag(InputLatency& latency, const InputSource source, const u32 source_ms, const i64 read_ns)
+{
+	if (!latency.is_enabled)
+		return;
+	if (latency.event_count == latency_max_events) {
+		latency.dropped_events++;
+		return;
+	}
+
+	auto& event = latency.events[latency.event_count++];
+	event.source = source;
+	event.read_ns = read_ns;
+	event.source_ns = input_latency_source_ns(latency.clocks[source], source_ms, read_ns);
+}
+
+// Called when an update has run this frame, update_ns is when the first one started
+void input_latency_consumed(InputLatency& latency, const i64 update_ns)
+{
+	if (!latency.is_enabled || latency.consumed_count == latency.event_count)
+		return;
+	latency.consumed_count = latency.event_count;
+	latency.consumed_ns = update_ns;
+}
+
+void input_latency_histogram_add(LatencyHistogram& histogram, const i64 ns)
+{
+	histogram.buckets[frame_stats_bucket(ns > 0 ? (u64)ns : 0)]++;
+	histogram.count++;
+	if (ns > histogram.max_ns)
+		histogram.max_ns = ns;
+}
+
+// Called once the frame rendered after the consuming update has been presented
+void input_latency_presented(InputLatency& latency, const i64 present_ns, const i64 complete_ns)
+{
+	if (!latency.is_enabled || !latency.consumed_count)
+		return;
+
+	for (int i = 0; i < latency.consumed_count; i++) {
+		const auto& event = latency.events[i];
+		auto histograms = latency.histograms + (int)event.source * (int)LatencyStage_Count;
+		input_latency_histogram_add(histograms[LatencyStage_Poll], event.read_ns - event.source_ns);
+		input_latency_histogram_add(histograms[LatencyStage_Wait], latency.consumed_ns - event.read_ns);
+		input_latency_histogram_add(histograms[LatencyStage_Frame], present_ns - latency.consumed_ns);
+		input_latency_histogram_add(histograms[LatencyStage_Present], complete_ns - present_ns);
+		input_latency_histogram_add(histograms[LatencyStage_Total], complete_ns - event.source_ns);
+	}
+
+	// Anything read after the update waits for the next one
+	latency.event_count -= latency.consumed_count;
+	memmove(latency.events, latency.events + latency.consumed_count, latency.event_count * sizeof(LatencyEvent));
+	latency.consumed_count = 0;
+}
+
+u64 input_latency_percentile(const LatencyHistogram& histogram, const double percentile)
+{
+	const auto target = (u64)(percentile / 100.0 * histogram.count);
+	u64 seen = 0;
+	for (int i = 0; i < frame_stats_bucket_count; i++) {
+		seen += histogram.buckets[i];
+		if (seen > target)
+			return frame_stats_bucket_limit(i);
+	}
+	return 0;
+}
+
+void input_latency_report(const InputLatency& latency)
+{
+	if (!latency.is_enabled)
+		return;
+
+	for (int source = 0; source < InputSource_Count; source++) {
+		const auto histograms = latency.histograms + source * LatencyStage_Count;
+		if (!histograms[LatencyStage_Total].count)
+			continue;
+
+		printf("[LATENCY]: %s, %lu events%s\n", input_source_names[source], histograms[LatencyStage_Total].count,
+			latency.clocks[source].is_same_clock ? "" : " (source clock offset estimated)");
+		for (int stage = 0; stage < LatencyStage_Count; stage++) {
+			const auto& histogram = histograms[stage];
+			printf("[LATENCY]:   %-7s p50 %.2fms, p90 %.2fms, p99 %.2fms, max %.2fms\n", latency_stage_names[stage],
+				input_latency_percentile(histogram, 50) / 1e6, input_latency_percentile(histogram, 90) / 1e6,
+				input_latency_percentile(histogram, 99) / 1e6, histogram.max_ns / 1e6);
+		}
+	}
+	if (latency.dropped_events)
+		printf("[LATENCY]: %lu events dropped\n", latency.dropped_events);
+}
@@ -0,0 +1,230 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "game.h"
+#include "types.h"
+
+// Thread pool with one Chase-Lev deque per thread. The thread that calls add_job pushes to its own deque,
+// idle threads steal from the top of the others. The main thread is thread 0 and helps run jobs while it
+// waits on a group, so nothing ever blocks on work that only it could run.
+
+const auto max_job_threads = 64;
+const auto job_deque_size = 4096; // Must be a power of 2
+
+struct Job {
+	JobFunc* func;
+	JobRangeFunc* range_func;
+	void* data;
+	u32 begin, end;
+	JobGroup* group;
+};
+
+struct alignas(64) JobDeque {
+	i64 top; // Stolen from here
+	alignas(64) i64 bottom; // Owner pushes and pops here
+	Job jobs[job_deque_size];
+};
+
+struct JobSystem {
+	int thread_count; // Including the main thread
+	bool is_stopping;
+	int sleeping_count;
+	sem_t wake;
+	pthread_t threads[max_job_threads];
+	JobDeque deques[max_job_threads];
+};
+
+JobSystem global_jobs;
+thread_local int job_thread_index; // 0 for the main thread
+
+bool job_deque_push(JobDeque& deque, const Job& job)
+{
+	const auto bottom = __atomic_load_n(&deque.bottom, __ATOMIC_RELAXED);
+	const auto top = __atomic_load_n(&deque.top, __ATOMIC_ACQUIRE);
+	if (bottom - top >= job_deque_size)
+		return false;
+
+	deque.jobs[bottom & (job_deque_size - 1)] = job;
+	__atomic_store_n(&deque.bottom, bottom + 1, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+bool job_deque_pop(JobDeque& deque, Job& job)
+{
+	const auto bottom = __atomic_load_n(&deque.bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&deque.bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	auto top = __atomic_load_n(&deque.top, __ATOMIC_RELAXED);
+
+	if (top > bottom) {
+		__atomic_store_n(&deque.bottom, bottom + 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	job = deque.jobs[bottom & (job_deque_size - 1)];
+	if (top == bottom) {
+		// Last job, race the thieves for it
+		const auto won = __atomic_compare_exchange_n(&deque.top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+		__atomic_store_n(&deque.bottom, bottom + 1, __ATOMIC_RELAXED);
+		return won;
+	}
+	return true;
+}
+
+bool job_deque_steal(JobDeque& deque, Job& job)
+{
+	auto top = __atomic_load_n(&deque.top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	const auto bottom = __atomic_load_n(&deque.bottom, __ATOMIC_ACQUIRE);
+	if (top >= bottom)
+		return false;
+
+	job = deque.jobs[top & (job_deque_size - 1)];
+	return __atomic_compare_exchange_n(&deque.top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+void job_run(const Job& job)
+{
+	if (job.range_func)
+		job.range_func(job.data, job.begin, job.end);
+	else
+		job.func(job.data);
+
+	__atomic_sub_fetch(&job.group->pending, 1, __ATOMIC_RELEASE);
+}
+
+bool job_try_run_one(JobSystem& system)
+{
+	const auto self = job_thread_index;
+	Job job;
+	if (job_deque_pop(system.deques[self], job)) {
+		job_run(job);
+		return true;
+	}
+
+	for (int i = 1; i < system.thread_count; i++) {
+		const auto victim = (self + i) % system.thread_count;
+		if (job_deque_steal(system.deques[victim], job)) {
+			job_run(job);
+			return true;
+		}
+	}
+	return false;
+}
+
+void job_wake_sleepers(JobSystem& system)
+{
+	if (__atomic_load_n(&system.sleeping_count, __ATOMIC_SEQ_CST) > 0)
+		sem_post(&system.wake);
+}
+
+void* job_thread_proc(void* param)
+{
+	auto& system = global_jobs;
+	job_thread_index = (int)(i64)param;
+
+	while (!__atomic_load_n(&system.is_stopping, __ATOMIC_ACQUIRE)) {
+		if (job_try_run_one(system))
+			continue;
+
+		// Announce the sleep before the last look, so a concurrent add_job either sees us or we see its job
+		__atomic_add_fetch(&system.sleeping_count, 1, __ATOMIC_SEQ_CST);
+		if (job_try_run_one(system)) {
+			__atomic_sub_fetch(&system.sleeping_count, 1, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		sem_wait(&system.wake);
+		__atomic_sub_fetch(&system.sleeping_count, 1, __ATOMIC_SEQ_CST);
+	}
+	return 0;
+}
+
+void platform_add_job(JobGroup& group, JobFunc* const func, void* const data)
+{
+	auto& system = global_jobs;
+	__atomic_add_fetch(&group.pending, 1, __ATOMIC_RELAXED);
+
+	const Job job = { .func = func, .data = data, .group = &group };
+	if (!job_deque_push(system.deques[job_thread_index], job)) {
+		job_run(job); // Queue is full, run it right here
+		return;
+	}
+	job_wake_sleepers(system);
+}
+
+void platform_wait_for_group(JobGroup& group)
+{
+	auto& system = global_jobs;
+	while (__atomic_load_n(&group.pending, __ATOMIC_ACQUIRE) > 0) {
+		if (!job_try_run_one(system))
+			_mm_pause();
+	}
+}
+
+void platform_parallel_for(const u32 count, u32 batch_size, JobRangeFunc* const func, void* const data)
+{
+	auto& system = global_jobs;
+	if (!batch_size)
+		batch_size = (count + system.thread_count * 4 - 1) / (system.thread_count * 4);
+	if (!batch_size)
+		batch_size = 1;
+
+	JobGroup group = {};
+	for (u32 begin = 0; begin < count; begin += batch_size) {
+		const auto end = begin + batch_size < count ? begin + batch_size : count;
+		__atomic_add_fetch(&group.pending, 1, __ATOMIC_RELAXED);
+
+		const Job job = { .range_func = func, .data = data, .begin = begin, .end = end, .group = &group };
+		if (!job_deque_push(system.deques[job_thread_index], job))
+			job_run(job);
+		else
+			job_wake_sleepers(system);
+	}
+	platform_wait_for_group(group);
+}
+
+bool job_system_setup(PlatformJobs& jobs)
+{
+	auto& system = global_jobs;
+	auto core_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (core_count < 1)
+		core_count = 1;
+	if (core_count > max_job_threads)
+		core_count = max_job_threads;
+
+	system.thread_count = core_count;
+	sem_init(&system.wake, 0, 0);
+	job_thread_index = 0;
+
+	for (int i = 1; i < system.thread_count; i++) {
+		if (pthread_create(&system.threads[i], 0, job_thread_proc, (void*)(i64)i) != 0) {
+			fprintf(stderr, "[JOBS]: Failed to create worker %i\n", i);
+			system.thread_count = i;
+			break;
+		}
+	}
+
+	jobs.thread_count = system.thread_count;
+	jobs.add_job = platform_add_job;
+	jobs.wait_for_group = platform_wait_for_group;
+	jobs.parallel_for = platform_parallel_for;
+
+	printf("[JOBS]: %i threads\n", system.thread_count);
+	return true;
+}
+
+void job_system_shutdown()
+{
+	auto& system = global_jobs;
+	__atomic_store_n(&system.is_stopping, true, __ATOMIC_RELEASE);
+	for (int i = 1; i < system.thread_count; i++) {
+		sem_post(&system.wake);
+	}
+	for (int i = 1; i < system.thread_count; i++) {
+		pthread_join(system.threads[i], 0);
+	}
+	sem_destroy(&system.wake);
+}
@@ -9,6 +9,7 @@
 #include <sys/ipc.h>
 #include <unistd.h>
 
+#include "linux_log.h"
 #include "types.h"
 
 #define MAX_EVENTS 1024
@@ -32,13 +33,13 @@ void joystick_inotify_setup(JoystickInotify& inotify)
 {
 	inotify.fd = inotify_init();
 	if (fcntl(inotify.fd, F_SETFL, O_NONBLOCK) < 0) {
-		fprintf(stderr, "Failed to fctnl\n");
+		LOG_ERROR("[INOTIFY]: Failed to fcntl\n");
 	}
 
 	auto path = JOYSTICK_DIR;
 	inotify.wd = inotify_add_watch(inotify.fd, path, IN_CREATE | IN_DELETE);
 	if (inotify.wd != -1)
-		printf("[INOTIFY]: Watching %s\n", path);
+		LOG_INFO("[INOTIFY]: Watching %s\n", path);
 }
 
 void joystick_inotify_close(const JoystickInotify& inotify)
@@ -52,7 +53,7 @@ bool get_joystick(Joystick& joy, const char* const path)
 	bool result = false;
 	joy.fd = open(path, O_RDONLY | O_NONBLOCK);
 	if (joy.fd < 0) {
-		fprintf(stderr, "Couldn't open %s\n", path);
+		LOG_DEBUG("[JOYSTICK]: Couldn't open %s\n", path);
 		return result;
 	}
 
@@ -64,7 +65,7 @@ bool get_joystick(Joystick& joy, const char* const path)
 	char name[1024];
 	ioctl(joy.fd, JSIOCGNAME(sizeof(name)), name);
 
-	printf("[JOYSTICK]: %s is connected (Axis: %i, Buttons: %i)\n", name, num_axis, num_buttons);
+	LOG_INFO("[JOYSTICK]: %s is connected (Axis: %i, Buttons: %i)\n", name, num_axis, num_buttons);
 
 	auto corr = (js_corr*)malloc(num_axis * sizeof(js_corr));
 	ioctl(joy.fd, JSIOCGCORR, corr);
@@ -84,7 +85,7 @@ bool get_joystick(Joystick& joy, const char* const path)
 		joy.range_min = rint(center_min - ((32767.0 * 16384) / corr->coef[2]));
 		joy.range_max = rint((32767.0 * 16384) / corr->coef[3] + center_max);
 
-		printf("[JOYSTICK]: Invert: %i CenterMin: %i CenterMax: %i RangeMin: %i RangeMax: %i\n", invert, center_min, center_max, joy.range_min, joy.range_max);
+		LOG_INFO("[JOYSTICK]: Invert: %i CenterMin: %i CenterMax: %i RangeMin: %i RangeMax: %i\n", invert, center_min, center_max, joy.range_min, joy.range_max);
 
 		result = true;
 	}
@@ -129,7 +130,7 @@ void joystick_inotify_update(const JoystickInotify& inotify, Joystick* const joy
 				if (strncmp(event->name, pattern, pattern_len) == 0) {
 					sleep(1); // @Hack
 					if (event->mask & IN_CREATE) {
-						printf("[INOTIFY]: %s was created\n", event->name);
+						LOG_INFO("[INOTIFY]: %s was created\n", event->name);
 						auto joy_index = strtol(event->name, 0, 10);
 
 						if (joy_index < max_joy_count) {
@@ -138,7 +139,7 @@ void joystick_inotify_update(const JoystickInotify& inotify, Joystick* const joy
 						}
 
 					} else if (event->mask & IN_DELETE) {
-						printf("[INOTIFY]: %s was deleted\n", event->name);
+						LOG_INFO("[INOTIFY]: %s was deleted\n", event->name);
 						auto joy_index = strtol(event->name, 0, 10);
 
 						if (joy_index < max_joy_count) {
@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "linux_log.h"
+#include "types.h"
+
+// Writer side of linux_log.h. Formatting walks the format string and hands snprintf one conversion at a time,
+// with the stored argument converted to the type that conversion expects.
+
+bool log_parse_level(const char* name, LogLevel& level)
+{
+	for (int i = 0; i < (int)(sizeof(log_level_names) / sizeof(log_level_names[0])); i++) {
+		if (strcmp(name, log_level_names[i]) == 0) {
+			level = (LogLevel)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+i64 log_arg_signed(const LogRecord& record, const int arg)
+{
+	if (record.arg_types[arg] == LogArg_Double) {
+		double value;
+		memcpy(&value, &record.args[arg], sizeof(value));
+		return (i64)value;
+	}
+	return (i64)record.args[arg];
+}
+
+double log_arg_double(const LogRecord& record, const int arg)
+{
+	switch (record.arg_types[arg]) {
+	case LogArg_Double: {
+		double value;
+		memcpy(&value, &record.args[arg], sizeof(value));
+		return value;
+	}
+	case LogArg_Signed:
+		return (double)(i64)record.args[arg];
+	default:
+		return (double)record.args[arg];
+	}
+}
+
+// Returns the number of characters written, like snprintf but never more than out_size - 1
+int log_format_spec(const LogRecord& record, const int arg, const char* const spec, char* const out, const int out_size)
+{
+	const auto length = strlen(spec);
+	const auto conversion = spec[length - 1];
+	const auto is_long_long = length >= 3 && spec[length - 2] == 'l' && spec[length - 3] == 'l';
+	const auto is_long = !is_long_long && length >= 2 && (spec[length - 2] == 'l' || spec[length - 2] == 'z');
+
+	if (arg >= record.arg_count)
+		return snprintf(out, out_size, "<missing>");
+
+	int written;
+	switch (conversion) {
+	case 'd':
+	case 'i':
+	case 'c':
+		if (is_long_long)
+			written = snprintf(out, out_size, spec, (long long)log_arg_signed(record, arg));
+		else if (is_long)
+			written = snprintf(out, out_size, spec, (long)log_arg_signed(record, arg));
+		else
+			written = snprintf(out, out_size, spec, (int)log_arg_signed(record, arg));
+		break;
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+		if (is_long_long)
+			written = snprintf(out, out_size, spec, (unsigned long long)log_arg_signed(record, arg));
+		else if (is_long)
+			written = snprintf(out, out_size, spec, (unsigned long)log_arg_signed(record, arg));
+		else
+			written = snprintf(out, out_size, spec, (unsigned)log_arg_signed(record, arg));
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+		written = snprintf(out, out_size, spec, log_arg_double(record, arg));
+		break;
+	case 's':
+		written = snprintf(out, out_size, spec, record.arg_types[arg] == LogArg_String ? record.strings + record.args[arg] : "<not a string>");
+		break;
+	case 'p':
+		written = snprintf(out, out_size, spec, (void*)record.args[arg]);
+		break;
+	default:
+		written = snprintf(out, out_size, "<bad format %s>", spec);
+		break;
+	}
+	if (written < 0)
+		return 0;
+	return written < out_size ? written : out_size - 1;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+void log_format_record(const LogRecord& record, char* out, const int out_size)
+{
+	const auto format = record.site->format;
+	auto used = 0;
+	auto arg = 0;
+	for (auto p = format; *p && used < out_size - 1;) {
+		if (*p != '%') {
+			out[used++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			out[used++] = '%';
+			p += 2;
+			continue;
+		}
+
+		// Flags, width, precision and length up to and including the conversion character
+		char spec[32];
+		auto spec_length = 0;
+		spec[spec_length++] = *p++;
+		while (*p && !strchr("diouxXeEfFgGcsp", *p) && spec_length < (int)sizeof(spec) - 2) {
+			spec[spec_length++] = *p++;
+		}
+		if (!*p)
+			break;
+		spec[spec_length++] = *p++;
+		spec[spec_length] = 0;
+
+		used += log_format_spec(record, arg++, spec, out + used, out_size - used);
+	}
+	out[used] = 0;
+}
+#pragma GCC diagnostic pop
+
+void log_write_record(const LogRecord& record)
+{
+	char line[1024];
+	auto length = 0;
+	if (record.suppressed)
+		length = snprintf(line, sizeof(line), "[LOG]: %u more like the next were rate limited\n", record.suppressed);
+	log_format_record(record, line + length, sizeof(line) - length);
+	length += strlen(line + length);
+
+	auto out = record.site->level >= LogLevel_Warn ? stderr : stdout;
+	fwrite(line, 1, length, out);
+}
+
+void* log_writer_proc(void* data)
+{
+	auto& log = global_log;
+	u64 reported_dropped = 0;
+	while (true) {
+		const auto is_stopping = __atomic_load_n(&log.is_stopping, __ATOMIC_ACQUIRE);
+		auto wrote_any = false;
+		while (true) {
+			auto& record = log.records[log.tail & (log_ring_size - 1)];
+			if (__atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE) != log.tail + 1)
+				break;
+			log_write_record(record);
+			__atomic_store_n(&record.sequence, log.tail + log_ring_size, __ATOMIC_RELEASE);
+			log.tail++;
+			wrote_any = true;
+		}
+
+		const auto dropped = __atomic_load_n(&log.dropped, __ATOMIC_RELAXED);
+		if (dropped != reported_dropped) {
+			fprintf(stderr, "[LOG]: Ring full, %lu messages dropped\n", dropped - reported_dropped);
+			reported_dropped = dropped;
+			wrote_any = true;
+		}
+		if (wrote_any) {
+			fflush(stdout);
+			fflush(stderr);
+		}
+
+		if (is_stopping)
+			break;
+		usleep(log_flush_interval_us);
+	}
+	return 0;
+}
+
+bool log_setup(const LogLevel min_level)
+{
+	auto& log = global_log;
+	log.min_level = min_level;
+	log.records = (LogRecord*)aligned_alloc(64, log_ring_size * sizeof(LogRecord));
+	if (!log.records) {
+		fprintf(stderr, "[LOG]: Failed to allocate the ring, logging synchronously\n");
+		return false;
+	}
+	for (int i = 0; i < log_ring_size; i++) {
+		log.records[i].sequence = i;
+	}
+	log.head = log.tail = 0;
+
+	if (pthread_create(&log.writer, 0, log_writer_proc, 0) != 0) {
+		fprintf(stderr, "[LOG]: Failed to start the writer thread, logging synchronously\n");
+		free(log.records);
+		log.records = 0;
+		return false;
+	}
+	__atomic_store_n(&log.is_running, true, __ATOMIC_RELEASE);
+	return true;
+}
+
+// Writes out everything still queued, later calls log synchronously
+void log_shutdown()
+{
+	auto& log = global_log;
+	if (!log.is_running)
+		return;
+	__atomic_store_n(&log.is_running, false, __ATOMIC_SEQ_CST);
+	// A producer that saw is_running may still be filling in its record, the writer's last pass has to see it
+	while (__atomic_load_n(&log.producer_count, __ATOMIC_SEQ_CST) != 0) {
+		sched_yield();
+	}
+	__atomic_store_n(&log.is_stopping, true, __ATOMIC_RELEASE);
+	pthread_join(log.writer, 0);
+}
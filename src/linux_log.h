@@ -0,0 +1,229 @@
+#pragma once
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "types.h"
+
+// Logging that never blocks the calling thread. A call copies its arguments raw into a fixed-size record in a
+// lock-free ring (multiple producers, one consumer) and returns; the format string stays a pointer to the call
+// site. A background thread wakes every few milliseconds, formats what's queued and writes it out.
+// When the ring is full the record is dropped and counted instead of waiting. Every call site is also rate limited,
+// so a message logged every frame can't flood the ring or the terminal.
+//
+//	LOG_INFO("[ALSA]: Only wrote %ld frames (expected %d frames)\n", frames_written, frames_to_write);
+//
+// The format is checked like printf's at compile time. Strings are copied into the record (truncated past
+// log_string_bytes in total), everything else is stored as a 64-bit integer or a double.
+// Info and debug go to stdout, warnings and errors to stderr.
+
+enum LogLevel {
+	LogLevel_Debug,
+	LogLevel_Info,
+	LogLevel_Warn,
+	LogLevel_Error,
+};
+
+const char* const log_level_names[] = { "debug", "info", "warn", "error" };
+
+const auto log_ring_size = 4096; // Records, must be a power of 2
+const auto log_max_args = 8;
+const auto log_string_bytes = 144;
+const auto log_rate_limit = 20; // Per call site per second
+const auto log_flush_interval_us = 2000;
+
+struct LogSite {
+	LogLevel level;
+	const char* format;
+
+	// Rate limiting, only touched atomically
+	i64 window_start_ns;
+	u32 window_count;
+	u32 suppressed; // Since the last record of this site that got through
+};
+
+enum LogArgType : u8 {
+	LogArg_Signed,
+	LogArg_Unsigned,
+	LogArg_Double,
+	LogArg_String, // Value is the offset into strings
+	LogArg_Pointer,
+};
+
+struct alignas(64) LogRecord {
+	u64 sequence; // Ring slot state, see log_claim
+	i64 time_ns;
+	LogSite* site;
+	u32 suppressed; // Records of this site dropped by the rate limit right before this one
+	u8 arg_count;
+	u8 string_used;
+	LogArgType arg_types[log_max_args];
+	u64 args[log_max_args];
+	char strings[log_string_bytes];
+};
+
+struct Log {
+	bool is_running;
+	bool is_stopping;
+	LogLevel min_level;
+	pthread_t writer;
+	LogRecord* records;
+	alignas(64) u64 head; // Next slot to claim, producers
+	u32 producer_count; // log_write calls past the is_running check that haven't published yet
+	alignas(64) u64 tail; // Next slot to format, writer thread only
+	u64 dropped; // Ring full
+};
+
+inline Log global_log = { .min_level = LogLevel_Info };
+
+inline i64 log_time_ns()
+{
+	timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000000000ll + spec.tv_nsec;
+}
+
+// Returns false when the call site already used its budget for the current second
+inline bool log_rate_check(LogSite& site, const i64 now_ns)
+{
+	auto window_start = __atomic_load_n(&site.window_start_ns, __ATOMIC_RELAXED);
+	if (now_ns - window_start >= 1000000000ll) {
+		// Only one thread gets to start the new window, the others count against it
+		if (__atomic_compare_exchange_n(&site.window_start_ns, &window_start, now_ns, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&site.window_count, 1, __ATOMIC_RELAXED);
+			return true;
+		}
+	}
+	if (__atomic_add_fetch(&site.window_count, 1, __ATOMIC_RELAXED) <= (u32)log_rate_limit)
+		return true;
+	__atomic_add_fetch(&site.suppressed, 1, __ATOMIC_RELAXED);
+	return false;
+}
+
+// Bounded MPMC ring in the style of Vyukov's: slot i is free for position p when its sequence is p, and holds a
+// record for the consumer when it is p + 1
+inline LogRecord* log_claim(Log& log)
+{
+	auto position = __atomic_load_n(&log.head, __ATOMIC_RELAXED);
+	while (true) {
+		auto& record = log.records[position & (log_ring_size - 1)];
+		const auto sequence = __atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE);
+		const auto diff = (i64)(sequence - position);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&log.head, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return &record;
+		} else if (diff < 0) {
+			__atomic_add_fetch(&log.dropped, 1, __ATOMIC_RELAXED);
+			return 0;
+		} else {
+			position = __atomic_load_n(&log.head, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+inline void log_pack_signed(LogRecord& record, const i64 value)
+{
+	record.arg_types[record.arg_count] = LogArg_Signed;
+	record.args[record.arg_count++] = (u64)value;
+}
+
+inline void log_pack_unsigned(LogRecord& record, const u64 value)
+{
+	record.arg_types[record.arg_count] = LogArg_Unsigned;
+	record.args[record.arg_count++] = value;
+}
+
+inline void log_pack_arg(LogRecord& record, const int value) { log_pack_signed(record, value); }
+inline void log_pack_arg(LogRecord& record, const long value) { log_pack_signed(record, value); }
+inline void log_pack_arg(LogRecord& record, const long long value) { log_pack_signed(record, value); }
+inline void log_pack_arg(LogRecord& record, const unsigned value) { log_pack_unsigned(record, value); }
+inline void log_pack_arg(LogRecord& record, const unsigned long value) { log_pack_unsigned(record, value); }
+inline void log_pack_arg(LogRecord& record, const unsigned long long value) { log_pack_unsigned(record, value); }
+
+inline void log_pack_arg(LogRecord& record, const double value)
+{
+	record.arg_types[record.arg_count] = LogArg_Double;
+	memcpy(&record.args[record.arg_count++], &value, sizeof(value));
+}
+
+inline void log_pack_arg(LogRecord& record, const char* const value)
+{
+	const auto offset = record.string_used;
+	auto length = value ? strlen(value) : 0;
+	if (length > log_string_bytes - 1u - offset)
+		length = log_string_bytes - 1u - offset;
+	memcpy(record.strings + offset, value, length);
+	record.strings[offset + length] = 0;
+	record.string_used = (u8)(offset + length + 1 < log_string_bytes ? offset + length + 1 : log_string_bytes - 1);
+
+	record.arg_types[record.arg_count] = LogArg_String;
+	record.args[record.arg_count++] = offset;
+}
+
+inline void log_pack_arg(LogRecord& record, const void* const value)
+{
+	record.arg_types[record.arg_count] = LogArg_Pointer;
+	record.args[record.arg_count++] = (u64)value;
+}
+
+void log_format_record(const LogRecord& record, char* out, const int out_size);
+void log_write_record(const LogRecord& record);
+
+template<typename... Args>
+void log_write(LogSite& site, const Args... args)
+{
+	static_assert(sizeof...(Args) <= log_max_args, "Too many log arguments");
+	const auto now_ns = log_time_ns();
+	if (!log_rate_check(site, now_ns))
+		return;
+
+	// log_shutdown waits for producer_count to reach zero after clearing is_running, so a record claimed here is
+	// always published before the writer's last pass
+	auto& log = global_log;
+	__atomic_add_fetch(&log.producer_count, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&log.is_running, __ATOMIC_SEQ_CST)) {
+		__atomic_sub_fetch(&log.producer_count, 1, __ATOMIC_RELEASE);
+		// Before setup and after shutdown the caller formats and writes it itself
+		LogRecord record = { .time_ns = now_ns, .site = &site };
+		(log_pack_arg(record, args), ...);
+		log_write_record(record);
+		return;
+	}
+
+	auto record = log_claim(log);
+	if (!record) {
+		__atomic_sub_fetch(&log.producer_count, 1, __ATOMIC_RELEASE);
+		return;
+	}
+	record->time_ns = now_ns;
+	record->site = &site;
+	record->suppressed = __atomic_exchange_n(&site.suppressed, 0, __ATOMIC_RELAXED);
+	record->arg_count = 0;
+	record->string_used = 0;
+	(log_pack_arg(*record, args), ...);
+
+	const auto position = record->sequence;
+	__atomic_store_n(&record->sequence, position + 1, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&log.producer_count, 1, __ATOMIC_RELEASE);
+}
+
+// The dead printf call is only there for the compile-time format check
+#define LOG(level, format, ...)                                           \
+	do {                                                                  \
+		static LogSite log_site_ = { level, format };                     \
+		if (level >= global_log.min_level)                                \
+			log_write(log_site_ __VA_OPT__(, ) __VA_ARGS__);              \
+		if (0)                                                            \
+			printf(format __VA_OPT__(, ) __VA_ARGS__);                    \
+	} while (0)
+
+#define LOG_DEBUG(format, ...) LOG(LogLevel_Debug, format __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_INFO(format, ...) LOG(LogLevel_Info, format __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_WARN(format, ...) LOG(LogLevel_Warn, format __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG(LogLevel_Error, format __VA_OPT__(, ) __VA_ARGS__)
+
+bool log_setup(const LogLevel min_level);
+void log_shutdown();
+bool log_parse_level(const char* name, LogLevel& level);
@@ -0,0 +1,38 @@
+#include "game.h"
+#include "simd.h"
+#include "types.h"
+
+// Expansion of PixelFormat_Indexed8 frames through their palette into 32-bit pixels, done at present so a
+// palette change shows up on the next present without the game redrawing anything.
+
+void palette_expand_row(const u8* const src, u32* const dst, const int count, const u32* const palette)
+{
+	for (int x = 0; x < count; x++) {
+		dst[x] = palette[src[x]];
+	}
+}
+
+// 8 pixels per gather, the 1 KiB palette stays in L1
+__attribute__((target("avx2"))) void palette_expand_row_avx2(const u8* const src, u32* const dst, const int count, const u32* const palette)
+{
+	int x = 0;
+	for (; x + 8 <= count; x += 8) {
+		const auto indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x)));
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_i32gather_epi32((const int*)palette, indices, 4));
+	}
+	palette_expand_row(src + x, dst + x, count - x, palette);
+}
+
+// dst is 32-bit and the same size as src
+void palette_expand(const GameScreenBuffer& src, char* const dst, const int dst_pitch, const bool use_avx2)
+{
+	assert(src.format == PixelFormat_Indexed8 && src.palette);
+	for (int y = 0; y < src.height; y++) {
+		const auto src_row = (const u8*)src.buffer + y * src.width;
+		const auto dst_row = (u32*)(dst + y * dst_pitch);
+		if (use_avx2)
+			palette_expand_row_avx2(src_row, dst_row, src.width, src.palette);
+		else
+			palette_expand_row(src_row, dst_row, src.width, src.palette);
+	}
+}
@@ -0,0 +1,138 @@
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "types.h"
+
+// Hardware counters for the main thread, opened as one perf_event group so a single read() returns all of
+// them. Counting is user-space only, which is what perf_event_paranoid=2 still allows. Anything the kernel
+// or the machine refuses is left out, and with no leader everything reads as zero.
+
+enum PerfCounter {
+	PerfCounter_Cycles,
+	PerfCounter_Instructions,
+	PerfCounter_CacheMisses,
+	PerfCounter_BranchMisses,
+	PerfCounter_PageFaults,
+	PerfCounter_Count,
+};
+
+const char* const perf_counter_names[PerfCounter_Count] = { "cycles", "instructions", "cache-misses", "branch-misses", "page-faults" };
+
+struct PerfSample {
+	u64 values[PerfCounter_Count];
+};
+
+struct PerfCounters {
+	int leader_fd; // -1 when unavailable
+	int fds[PerfCounter_Count];
+	int group_index[PerfCounter_Count]; // Position in the group read, -1 when the counter didn't open
+	int group_size;
+};
+
+int perf_event_open(perf_event_attr& attr, const int group_fd)
+{
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+bool perf_counters_setup(PerfCounters& perf)
+{
+	const struct {
+		u32 type;
+		u64 config;
+	} events[PerfCounter_Count] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	};
+
+	perf = {};
+	perf.leader_fd = -1;
+	for (int i = 0; i < PerfCounter_Count; i++) {
+		perf.fds[i] = -1;
+		perf.group_index[i] = -1;
+	}
+
+	for (int i = 0; i < PerfCounter_Count; i++) {
+		perf_event_attr attr = {};
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.disabled = perf.leader_fd < 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		const auto fd = perf_event_open(attr, perf.leader_fd);
+		if (fd < 0) {
+			fprintf(stderr, "[PERF]: %s unavailable: %s\n", perf_counter_names[i], strerror(errno));
+			continue;
+		}
+
+		if (perf.leader_fd < 0)
+			perf.leader_fd = fd;
+		perf.fds[i] = fd;
+		perf.group_index[i] = perf.group_size++;
+	}
+
+	if (perf.leader_fd < 0) {
+		fprintf(stderr, "[PERF]: No hardware counters (check /proc/sys/kernel/perf_event_paranoid)\n");
+		return false;
+	}
+
+	ioctl(perf.leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(perf.leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+}
+
+// Running totals, so a block costs the difference of two samples
+PerfSample perf_sample(const PerfCounters& perf)
+{
+	PerfSample sample = {};
+	if (perf.leader_fd < 0)
+		return sample;
+
+	u64 data[3 + PerfCounter_Count];
+	const auto bytes_read = read(perf.leader_fd, data, sizeof(data));
+	if (bytes_read < (i64)(3 * sizeof(u64)))
+		return sample;
+
+	// Scale up when the kernel had to multiplex the group
+	const auto time_enabled = data[1];
+	const auto time_running = data[2];
+	for (int i = 0; i < PerfCounter_Count; i++) {
+		const auto index = perf.group_index[i];
+		if (index < 0 || (u64)index >= data[0])
+			continue;
+
+		auto value = data[3 + index];
+		if (time_running && time_running < time_enabled)
+			value = (u64)((double)value * time_enabled / time_running);
+		sample.values[i] = value;
+	}
+	return sample;
+}
+
+PerfSample perf_sample_delta(const PerfSample& begin, const PerfSample& end)
+{
+	PerfSample delta;
+	for (int i = 0; i < PerfCounter_Count; i++) {
+		delta.values[i] = end.values[i] - begin.values[i];
+	}
+	return delta;
+}
+
+void perf_counters_close(PerfCounters& perf)
+{
+	for (int i = 0; i < PerfCounter_Count; i++) {
+		if (perf.fds[i] >= 0)
+			close(perf.fds[i]);
+	}
+	perf = {};
+	perf.leader_fd = -1;
+}
@@ -0,0 +1,296 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "types.h"
+
+// Rewind history for perm_storage built from page-level deltas.
+// Between snapshots perm_storage is kept read-only, the first write to a page faults and the SIGSEGV handler
+// records the page and unprotects it. A snapshot stores, for every dirty page, the XOR against a shadow copy
+// of the previous snapshot, run-length encoded. XOR deltas undo themselves, so stepping back applies the newest
+// delta to both perm_storage and the shadow.
+// The first snapshot only fills the shadow: a delta against the zeroed memory rewind_init starts from would step
+// back to a GameState that was never initialized.
+// The game writes perm_storage from the job threads too, so several threads can fault at once: a page is claimed
+// with an atomic exchange on is_dirty and gets its dirty_pages slot from an atomic add. Snapshots and stepping back
+// run on the main thread between frames, when no job is running.
+// @Volatile: nothing may write into perm_storage from the kernel side (read() into it fails with EFAULT).
+
+const u64 rewind_page_size = 4096;
+const auto rewind_page_words = rewind_page_size / sizeof(u64);
+const auto rewind_max_encoded_page = rewind_page_size + 8; // Worst case of rewind_encode_page plus the page index
+
+struct RewindDelta {
+	u64 offset; // Into RewindBuffer::data
+	u64 size;
+	u32 page_count;
+};
+
+struct RewindBuffer {
+	u8* base;
+	u64 page_count;
+	u8* shadow; // perm_storage as of the newest snapshot
+	bool has_baseline; // The shadow holds a snapshot, not the zeroes from rewind_init
+
+	u8* is_dirty; // Per page, claimed atomically from the signal handler
+	u32* dirty_pages;
+	u32 dirty_count; // Only touched atomically while the game runs
+
+	u8* data;
+	u64 data_capacity;
+	u64 write_offset;
+
+	RewindDelta* deltas;
+	u32 delta_capacity;
+	u32 oldest_delta;
+	u32 delta_count;
+
+	struct sigaction prev_segv_action;
+};
+
+RewindBuffer* global_rewind;
+
+void rewind_segv_handler(int sig, siginfo_t* info, void* context)
+{
+	auto& rewind = *global_rewind;
+	const auto addr = (u8*)info->si_addr;
+	if (addr >= rewind.base && addr < rewind.base + rewind.page_count * rewind_page_size) {
+		const auto page = (u32)((addr - rewind.base) / rewind_page_size);
+		// Job threads can fault on the same page at once, only the one that claims it records it
+		if (!__atomic_exchange_n(&rewind.is_dirty[page], 1, __ATOMIC_ACQ_REL)) {
+			const auto slot = __atomic_fetch_add(&rewind.dirty_count, 1, __ATOMIC_RELAXED);
+			rewind.dirty_pages[slot] = page;
+		}
+		mprotect(rewind.base + page * rewind_page_size, rewind_page_size, PROT_READ | PROT_WRITE);
+		return;
+	}
+
+	// Not ours, let the fault happen again with the previous disposition
+	sigaction(SIGSEGV, &rewind.prev_segv_action, 0);
+}
+
+void* rewind_map(const u64 size)
+{
+	auto result = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return result == MAP_FAILED ? 0 : result;
+}
+
+// base must still be untouched (zero) memory, so the zero-filled shadow starts out equal to it
+bool rewind_init(RewindBuffer& rewind, void* const base, const u64 size, const u64 data_capacity, const u32 delta_capacity)
+{
+	rewind = {};
+	rewind.base = (u8*)base;
+	rewind.page_count = size / rewind_page_size;
+	rewind.shadow = (u8*)rewind_map(rewind.page_count * rewind_page_size);
+	rewind.is_dirty = (u8*)rewind_map(rewind.page_count);
+	rewind.dirty_pages = (u32*)rewind_map(rewind.page_count * sizeof(u32));
+	rewind.data = (u8*)rewind_map(data_capacity);
+	rewind.data_capacity = data_capacity;
+	rewind.deltas = (RewindDelta*)rewind_map(delta_capacity * sizeof(RewindDelta));
+	rewind.delta_capacity = delta_capacity;
+
+	if (!rewind.shadow || !rewind.is_dirty || !rewind.dirty_pages || !rewind.data || !rewind.deltas) {
+		fprintf(stderr, "[REWIND]: Failed to allocate history: %s\n", strerror(errno));
+		return false;
+	}
+
+	global_rewind = &rewind;
+	struct sigaction action = {};
+	action.sa_sigaction = rewind_segv_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGSEGV, &action, &rewind.prev_segv_action) < 0) {
+		fprintf(stderr, "[REWIND]: Failed to install SIGSEGV handler: %s\n", strerror(errno));
+		return false;
+	}
+
+	if (mprotect(rewind.base, rewind.page_count * rewind_page_size, PROT_READ) < 0) {
+		fprintf(stderr, "[REWIND]: Failed to mprotect: %s\n", strerror(errno));
+		return false;
+	}
+
+	printf("[REWIND]: Tracking %lu pages, %.1f MiB of history\n", rewind.page_count, (double)data_capacity / MiB(1));
+	return true;
+}
+
+// For a forked child that runs the game on its own: puts back the previous SIGSEGV disposition and leaves
+// perm_storage writable, so the child's writes neither fault into the handler nor count as rewind work
+void rewind_disarm()
+{
+	if (!global_rewind)
+		return;
+	sigaction(SIGSEGV, &global_rewind->prev_segv_action, 0);
+	mprotect(global_rewind->base, global_rewind->page_count * rewind_page_size, PROT_READ | PROT_WRITE);
+	global_rewind = 0;
+}
+
+// Encodes page ^ shadow as runs of [u16 zero words][u16 literal words][literal words...]
+u64 rewind_encode_page(const u64* const page, const u64* const shadow, u8* const out)
+{
+	auto at = out;
+	u32 word = 0;
+	while (word < rewind_page_words) {
+		u16 zero_words = 0;
+		while (word < rewind_page_words && page[word] == shadow[word]) {
+			zero_words++;
+			word++;
+		}
+
+		auto header = at;
+		at += 2 * sizeof(u16);
+		u16 literal_words = 0;
+		while (word < rewind_page_words && page[word] != shadow[word]) {
+			const auto delta = page[word] ^ shadow[word];
+			memcpy(at, &delta, sizeof(delta));
+			at += sizeof(delta);
+			literal_words++;
+			word++;
+		}
+
+		memcpy(header, &zero_words, sizeof(u16));
+		memcpy(header + sizeof(u16), &literal_words, sizeof(u16));
+	}
+	return at - out;
+}
+
+// XORs an encoded delta into a page
+const u8* rewind_apply_page(const u8* at, u64* const page)
+{
+	u32 word = 0;
+	while (word < rewind_page_words) {
+		u16 zero_words, literal_words;
+		memcpy(&zero_words, at, sizeof(u16));
+		memcpy(&literal_words, at + sizeof(u16), sizeof(u16));
+		at += 2 * sizeof(u16);
+
+		word += zero_words;
+		for (u32 i = 0; i < literal_words; i++) {
+			u64 delta;
+			memcpy(&delta, at, sizeof(delta));
+			page[word++] ^= delta;
+			at += sizeof(delta);
+		}
+	}
+	return at;
+}
+
+void rewind_drop_oldest(RewindBuffer& rewind)
+{
+	rewind.oldest_delta = (rewind.oldest_delta + 1) % rewind.delta_capacity;
+	rewind.delta_count--;
+}
+
+bool rewind_overlaps_history(const RewindBuffer& rewind, const u64 offset, const u64 size)
+{
+	for (u32 i = 0; i < rewind.delta_count; i++) {
+		const auto& delta = rewind.deltas[(rewind.oldest_delta + i) % rewind.delta_capacity];
+		if (offset < delta.offset + delta.size && delta.offset < offset + size)
+			return true;
+	}
+	return false;
+}
+
+void rewind_protect_all(RewindBuffer& rewind)
+{
+	for (u32 i = 0; i < rewind.dirty_count; i++) {
+		rewind.is_dirty[rewind.dirty_pages[i]] = 0;
+	}
+	rewind.dirty_count = 0;
+	mprotect(rewind.base, rewind.page_count * rewind_page_size, PROT_READ);
+}
+
+// Call at a frame boundary, records everything written since the previous snapshot
+void rewind_snapshot(RewindBuffer& rewind)
+{
+	const auto dirty_count = rewind.dirty_count;
+	if (!dirty_count)
+		return;
+
+	const auto worst_size = dirty_count * rewind_max_encoded_page;
+	if (!rewind.has_baseline || worst_size > rewind.data_capacity) {
+		// The first snapshot, or too much changed to fit at all: history before this point is unreachable
+		rewind.has_baseline = true;
+		rewind.delta_count = 0;
+		for (u32 i = 0; i < dirty_count; i++) {
+			const auto offset = rewind.dirty_pages[i] * rewind_page_size;
+			memcpy(rewind.shadow + offset, rewind.base + offset, rewind_page_size);
+		}
+		rewind_protect_all(rewind);
+		return;
+	}
+
+	// A delta is always contiguous, history is only dropped as the encoder actually reaches it
+	if (rewind.write_offset + worst_size > rewind.data_capacity)
+		rewind.write_offset = 0;
+	if (rewind.delta_count == rewind.delta_capacity)
+		rewind_drop_oldest(rewind);
+
+	const auto start = rewind.data + rewind.write_offset;
+	auto at = start;
+	for (u32 i = 0; i < dirty_count; i++) {
+		while (rewind.delta_count && rewind_overlaps_history(rewind, at - rewind.data, rewind_max_encoded_page))
+			rewind_drop_oldest(rewind);
+
+		const auto page = rewind.dirty_pages[i];
+		const auto offset = page * rewind_page_size;
+		memcpy(at, &page, sizeof(page));
+		at += sizeof(page);
+		at += rewind_encode_page((u64*)(rewind.base + offset), (u64*)(rewind.shadow + offset), at);
+		memcpy(rewind.shadow + offset, rewind.base + offset, rewind_page_size);
+	}
+
+	auto& delta = rewind.deltas[(rewind.oldest_delta + rewind.delta_count) % rewind.delta_capacity];
+	delta.offset = rewind.write_offset;
+	delta.size = at - start;
+	delta.page_count = dirty_count;
+	rewind.delta_count++;
+	rewind.write_offset += delta.size;
+
+	rewind_protect_all(rewind);
+}
+
+// Restores perm_storage to the snapshot before the newest one, returns false when history is exhausted
+bool rewind_step_back(RewindBuffer& rewind)
+{
+	if (!rewind.has_baseline)
+		return false;
+	mprotect(rewind.base, rewind.page_count * rewind_page_size, PROT_READ | PROT_WRITE);
+
+	// Throw away whatever happened since the newest snapshot
+	for (u32 i = 0; i < rewind.dirty_count; i++) {
+		const auto offset = rewind.dirty_pages[i] * rewind_page_size;
+		memcpy(rewind.base + offset, rewind.shadow + offset, rewind_page_size);
+	}
+
+	auto stepped = false;
+	if (rewind.delta_count) {
+		const auto& delta = rewind.deltas[(rewind.oldest_delta + rewind.delta_count - 1) % rewind.delta_capacity];
+		const u8* at = rewind.data + delta.offset;
+		for (u32 i = 0; i < delta.page_count; i++) {
+			u32 page;
+			memcpy(&page, at, sizeof(page));
+			at += sizeof(page);
+
+			const auto offset = page * rewind_page_size;
+			rewind_apply_page(at, (u64*)(rewind.shadow + offset));
+			at = rewind_apply_page(at, (u64*)(rewind.base + offset));
+		}
+		rewind.delta_count--;
+		rewind.write_offset = delta.offset;
+		stepped = true;
+	}
+
+	rewind_protect_all(rewind);
+	return stepped;
+}
+
+u64 rewind_history_bytes(const RewindBuffer& rewind)
+{
+	u64 result = 0;
+	for (u32 i = 0; i < rewind.delta_count; i++) {
+		result += rewind.deltas[(rewind.oldest_delta + i) % rewind.delta_capacity].size;
+	}
+	return result;
+}
@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "game.h"
+#include "linux_log.h"
+#include "types.h"
+
+// Speculative sessions: fork() at a frame boundary and let each child run the game ahead on an input sequence of our
+// choosing. GameMemory is a private mapping, so a child starts out sharing it copy-on-write and only the pages it
+// writes get copied, instead of a deep copy of perm_storage per branch. The parent pays the same for pages it writes
+// while children are alive.
+// A child runs single threaded with the job table cleared, since the job threads don't exist after the fork, and
+// with rewind disarmed, so its page faults and timings are the game's alone. It sends a SpeculationReport per step
+// over its pipe, renders the final state into a buffer of its own and exits. Nothing it does reaches the parent's
+// state, the X connection or the audio device.
+// @Volatile: the child mustn't use stdio or anything else another thread could hold a lock on at the fork.
+
+const auto max_speculation_branches = 8;
+
+struct SpeculationReport {
+	u32 step; // Updates run, the final report has all of them
+	bool is_final;
+	GameSummary summary;
+	u64 page_faults; // Minor faults in the child, mostly pages copied on write
+	i64 elapsed_ns; // Since the fork
+	FrameHashes hashes; // Final report only: perm_storage and the frame rendered after the last step
+};
+
+struct SpeculationBranch {
+	pid_t pid;
+	int fd; // Read end of the child's pipe, non-blocking
+	u32 step_count;
+	bool is_done;
+	bool has_failed; // Exited without a final report
+	SpeculationReport report; // Newest received
+};
+
+struct Speculation {
+	SpeculationBranch branches[max_speculation_branches];
+	int branch_count;
+	int running_count;
+	i64 fork_ns; // Time the parent spent forking, all branches
+};
+
+i64 speculation_ns()
+{
+	timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000000000ll + spec.tv_nsec;
+}
+
+u64 speculation_page_faults()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage); // Starts from zero in a forked child
+	return usage.ru_minflt;
+}
+
+bool speculation_send(const int fd, const SpeculationReport& report)
+{
+	// Smaller than PIPE_BUF, so a write is never split
+	while (write(fd, &report, sizeof(report)) < 0) {
+		if (errno != EINTR)
+			return false;
+	}
+	return true;
+}
+
+// Runs in the child, never returns
+[[noreturn]] void speculation_run_child(GameMemory memory, const GameScreenBuffer& frame, const GameInput* const inputs, const u32 step_count, const int fd)
+{
+	memory.jobs = {};
+	rewind_disarm();
+	const auto start_ns = speculation_ns();
+
+	SpeculationReport report = {};
+	for (u32 step = 0; step < step_count; step++) {
+		game_update(memory, inputs[step], game_update_dt);
+		report.step = step + 1;
+		report.summary = game_summarize(memory);
+		report.page_faults = speculation_page_faults();
+		report.elapsed_ns = speculation_ns() - start_ns;
+		if (!speculation_send(fd, report))
+			_exit(1);
+	}
+
+	// The parent's image may be shared memory the server reads from, so render into a private copy
+	auto screen = frame;
+	screen.buffer = (char*)malloc(frame.pitch() * frame.height);
+	if (!screen.buffer)
+		_exit(1);
+	GameSoundBuffer sound = { .frame_rate = 48000, .channel_num = 2, .sample_buffer = 0, .frame_count = 0 };
+	game_render(memory, screen, sound, 0.f);
+
+	StateHashLog hash_log = { .use_avx2 = cpu_has_avx2() };
+	report.hashes = state_hash_frame(hash_log, memory, screen, sound);
+	report.is_final = true;
+	report.summary = game_summarize(memory);
+	report.page_faults = speculation_page_faults();
+	report.elapsed_ns = speculation_ns() - start_ns;
+	_exit(speculation_send(fd, report) ? 0 : 1);
+}
+
+// Forks one child per branch, each running step_count updates from the current state with its own inputs
+// (branch_count * step_count of them, branch after branch). Call between frames, with no jobs in flight.
+// frame is only used for its size and format.
+bool speculation_start(Speculation& speculation, const GameMemory& memory, const GameScreenBuffer& frame, const GameInput* const inputs,
+	const int branch_count, const u32 step_count)
+{
+	speculation = {};
+	if (branch_count > max_speculation_branches) {
+		fprintf(stderr, "[SPECULATE]: %i branches, at most %i\n", branch_count, max_speculation_branches);
+		return false;
+	}
+
+	const auto fork_start = speculation_ns();
+	for (int i = 0; i < branch_count; i++) {
+		auto& branch = speculation.branches[i];
+		int fds[2];
+		if (pipe(fds) != 0) {
+			fprintf(stderr, "[SPECULATE]: Failed to create a pipe: %s\n", strerror(errno));
+			break;
+		}
+
+		const auto pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "[SPECULATE]: Failed to fork: %s\n", strerror(errno));
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		}
+		if (pid == 0) {
+			close(fds[0]);
+			speculation_run_child(memory, frame, inputs + i * step_count, step_count, fds[1]);
+		}
+
+		close(fds[1]);
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		branch.pid = pid;
+		branch.fd = fds[0];
+		branch.step_count = step_count;
+		speculation.branch_count++;
+		speculation.running_count++;
+	}
+	speculation.fork_ns = speculation_ns() - fork_start;
+	return speculation.branch_count == branch_count;
+}
+
+// Takes in what the children sent so far without blocking, returns true once every branch is done
+bool speculation_poll(Speculation& speculation)
+{
+	for (int i = 0; i < speculation.branch_count; i++) {
+		auto& branch = speculation.branches[i];
+		if (branch.is_done)
+			continue;
+
+		SpeculationReport report;
+		i64 bytes_read;
+		while ((bytes_read = read(branch.fd, &report, sizeof(report))) == sizeof(report)) {
+			branch.report = report;
+		}
+		if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+
+		// End of file, or an error: the child is gone
+		close(branch.fd);
+		waitpid(branch.pid, 0, 0);
+		branch.is_done = true;
+		branch.has_failed = !branch.report.is_final;
+		speculation.running_count--;
+	}
+	return speculation.running_count == 0;
+}
+
+void speculation_cancel(Speculation& speculation)
+{
+	for (int i = 0; i < speculation.branch_count; i++) {
+		auto& branch = speculation.branches[i];
+		if (branch.is_done)
+			continue;
+		kill(branch.pid, SIGKILL);
+		close(branch.fd);
+		waitpid(branch.pid, 0, 0);
+		branch.is_done = true;
+		branch.has_failed = true;
+	}
+	speculation.running_count = 0;
+}
+
+void speculation_report(const Speculation& speculation, const char* const* const branch_names)
+{
+	LOG_INFO("[SPECULATE]: %i branches, forked in %.2fms\n", speculation.branch_count, speculation.fork_ns / 1e6);
+	for (int i = 0; i < speculation.branch_count; i++) {
+		const auto& branch = speculation.branches[i];
+		const auto& report = branch.report;
+		if (branch.has_failed) {
+			LOG_WARN("[SPECULATE]: %-7s failed after %u of %u steps\n", branch_names[i], report.step, branch.step_count);
+			continue;
+		}
+		LOG_INFO("[SPECULATE]: %-7s camera %.0f, %.0f, %u entities, %u particles, %lu page faults, %.1fms, state %016lx\n", branch_names[i],
+			(double)report.summary.x_offset, (double)report.summary.y_offset, report.summary.entity_count, report.summary.particle_count,
+			report.page_faults, report.elapsed_ns / 1e6, report.hashes.perm);
+	}
+}
@@ -0,0 +1,193 @@
+#include <emmintrin.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "game.h"
+#include "simd.h"
+#include "types.h"
+
+// Per-frame hashes of everything the game produces, for catching nondeterminism: the used part of perm_storage,
+// the frame and the sound. Recorded to a file on one run and compared on a later run with the same input, which
+// stops at the first frame that differs.
+//
+// The hash follows XXH3's accumulate step: 8 64-bit lanes, each adding the product of the low and high halves of
+// data ^ key plus the neighbouring lane's data. The key advances every 64-byte stripe so moved data changes the hash.
+// The SSE2 and AVX2 paths give the same result.
+// @Volatile: pointers live in perm_storage, so two runs only compare when it is mapped at the same address, and
+// ParticleSystem::use_avx2 makes a reference file specific to the CPU features of the machine that recorded it.
+
+const u64 state_hash_stripe = 64;
+const u64 state_hash_keys[8] = { 0xBE4BA423396CFEB8, 0x1CAD21F72C81017C, 0xDB979083E96DD4DE, 0x1F67B3B7A4A44072,
+	0x78E5C0CC4EE679CB, 0x2172FFCC7DD05A82, 0x8E2443F7744608B8, 0x4C263A81E69035E0 };
+const u64 state_hash_key_step = 0x9E3779B97F4A7C15;
+
+struct FrameHashes {
+	u64 frame_index;
+	u64 perm;
+	u64 screen;
+	u64 sound;
+};
+
+struct StateHashLog {
+	FILE* file;
+	bool is_checking; // Compare against the file instead of writing it
+	bool use_avx2;
+	u64 frame_count; // Hashed so far
+};
+
+u64 state_hash_mix(u64 h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCD;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53;
+	h ^= h >> 33;
+	return h;
+}
+
+u64 state_hash_finish(const u64* const acc, const u64 size, const u64 seed)
+{
+	auto h = state_hash_mix(seed ^ (size * 0x9E3779B97F4A7C15));
+	for (int i = 0; i < 8; i++) {
+		h = state_hash_mix(h ^ acc[i]);
+	}
+	return h;
+}
+
+inline __m128i state_hash_accumulate_sse2(const __m128i acc, const __m128i data, const __m128i key)
+{
+	const auto data_key = _mm_xor_si128(data, key);
+	const auto product = _mm_mul_epu32(data_key, _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1)));
+	return _mm_add_epi64(acc, _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+}
+
+u64 state_hash_sse2(const void* const data, const u64 size, const u64 seed)
+{
+	__m128i acc[4], key[4];
+	for (int i = 0; i < 4; i++) {
+		acc[i] = _mm_set_epi64x((i64)state_hash_keys[i * 2 + 1], (i64)state_hash_keys[i * 2]);
+		key[i] = acc[i];
+	}
+	const auto key_step = _mm_set1_epi64x((i64)state_hash_key_step);
+
+	const auto bytes = (const u8*)data;
+	const auto full_size = size & ~(state_hash_stripe - 1);
+	for (u64 offset = 0; offset < full_size; offset += state_hash_stripe) {
+		for (int i = 0; i < 4; i++) {
+			acc[i] = state_hash_accumulate_sse2(acc[i], _mm_loadu_si128((const __m128i*)(bytes + offset) + i), key[i]);
+			key[i] = _mm_add_epi64(key[i], key_step);
+		}
+	}
+	if (full_size != size) {
+		alignas(64) u8 tail[state_hash_stripe] = {};
+		memcpy(tail, bytes + full_size, size - full_size);
+		for (int i = 0; i < 4; i++) {
+			acc[i] = state_hash_accumulate_sse2(acc[i], _mm_load_si128((const __m128i*)tail + i), key[i]);
+		}
+	}
+
+	alignas(16) u64 lanes[8];
+	for (int i = 0; i < 4; i++) {
+		_mm_store_si128((__m128i*)lanes + i, acc[i]);
+	}
+	return state_hash_finish(lanes, size, seed);
+}
+
+__attribute__((target("avx2"))) inline __m256i state_hash_accumulate_avx2(const __m256i acc, const __m256i data, const __m256i key)
+{
+	const auto data_key = _mm256_xor_si256(data, key);
+	const auto product = _mm256_mul_epu32(data_key, _mm256_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1)));
+	return _mm256_add_epi64(acc, _mm256_add_epi64(product, _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+}
+
+__attribute__((target("avx2"))) u64 state_hash_avx2(const void* const data, const u64 size, const u64 seed)
+{
+	auto acc0 = _mm256_loadu_si256((const __m256i*)state_hash_keys);
+	auto acc1 = _mm256_loadu_si256((const __m256i*)state_hash_keys + 1);
+	auto key0 = acc0;
+	auto key1 = acc1;
+	const auto key_step = _mm256_set1_epi64x((i64)state_hash_key_step);
+
+	const auto bytes = (const u8*)data;
+	const auto full_size = size & ~(state_hash_stripe - 1);
+	for (u64 offset = 0; offset < full_size; offset += state_hash_stripe) {
+		acc0 = state_hash_accumulate_avx2(acc0, _mm256_loadu_si256((const __m256i*)(bytes + offset)), key0);
+		acc1 = state_hash_accumulate_avx2(acc1, _mm256_loadu_si256((const __m256i*)(bytes + offset) + 1), key1);
+		key0 = _mm256_add_epi64(key0, key_step);
+		key1 = _mm256_add_epi64(key1, key_step);
+	}
+	if (full_size != size) {
+		alignas(64) u8 tail[state_hash_stripe] = {};
+		memcpy(tail, bytes + full_size, size - full_size);
+		acc0 = state_hash_accumulate_avx2(acc0, _mm256_load_si256((const __m256i*)tail), key0);
+		acc1 = state_hash_accumulate_avx2(acc1, _mm256_load_si256((const __m256i*)tail + 1), key1);
+	}
+
+	alignas(32) u64 lanes[8];
+	_mm256_store_si256((__m256i*)lanes, acc0);
+	_mm256_store_si256((__m256i*)lanes + 1, acc1);
+	return state_hash_finish(lanes, size, seed);
+}
+
+u64 state_hash(const StateHashLog& log, const void* const data, const u64 size, const u64 seed)
+{
+	return log.use_avx2 ? state_hash_avx2(data, size, seed) : state_hash_sse2(data, size, seed);
+}
+
+// Call after game_render, perm_storage_used has to be current
+FrameHashes state_hash_frame(const StateHashLog& log, const GameMemory& memory, const GameScreenBuffer& buffer, const GameSoundBuffer& sound_buffer)
+{
+	FrameHashes hashes = { .frame_index = log.frame_count };
+	hashes.perm = state_hash(log, memory.perm_storage, memory.perm_storage_used, 1);
+	hashes.screen = state_hash(log, buffer.buffer, (u64)buffer.pitch() * buffer.height, 2);
+	if (buffer.palette)
+		hashes.screen = state_hash(log, buffer.palette, 256 * sizeof(u32), hashes.screen);
+	hashes.sound = state_hash(log, sound_buffer.sample_buffer, (u64)sound_buffer.frame_count * sound_buffer.channel_num * sizeof(i16), 3);
+	return hashes;
+}
+
+// Records to filename, or with is_checking compares against what an earlier run recorded there
+bool state_hash_open(StateHashLog& log, const char* const filename, const bool is_checking)
+{
+	log = {};
+	log.is_checking = is_checking;
+	log.use_avx2 = cpu_has_avx2();
+	log.file = fopen(filename, is_checking ? "rb" : "wb");
+	if (!log.file) {
+		fprintf(stderr, "[HASH]: Failed to open %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+// Returns false at the first frame that differs from the reference. Frames past the end of the reference pass.
+bool state_hash_step(StateHashLog& log, const GameMemory& memory, const GameScreenBuffer& buffer, const GameSoundBuffer& sound_buffer)
+{
+	if (!log.file)
+		return true;
+
+	const auto hashes = state_hash_frame(log, memory, buffer, sound_buffer);
+	log.frame_count++;
+	if (!log.is_checking) {
+		fwrite(&hashes, sizeof(hashes), 1, log.file);
+		return true;
+	}
+
+	FrameHashes expected;
+	if (fread(&expected, sizeof(expected), 1, log.file) != 1)
+		return true;
+	if (expected.perm == hashes.perm && expected.screen == hashes.screen && expected.sound == hashes.sound)
+		return true;
+
+	fprintf(stderr, "[HASH]: Frame %lu differs from the reference in%s%s%s\n", hashes.frame_index, expected.perm != hashes.perm ? " perm_storage" : "",
+		expected.screen != hashes.screen ? " screen" : "", expected.sound != hashes.sound ? " sound" : "");
+	return false;
+}
+
+void state_hash_close(StateHashLog& log)
+{
+	if (log.file)
+		fclose(log.file);
+	log.file = 0;
+}
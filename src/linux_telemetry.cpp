@@ -0,0 +1,78 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+#include "types.h"
+
+// Publishes per-frame metrics to a POSIX shared-memory segment, see telemetry.h for the layout
+
+struct Telemetry {
+	char name[64];
+	TelemetryBlock* block;
+};
+
+bool telemetry_setup(Telemetry& telemetry)
+{
+	telemetry = {};
+	snprintf(telemetry.name, sizeof(telemetry.name), telemetry_name_format, getpid());
+
+	const auto fd = shm_open(telemetry.name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "[TELEMETRY]: Failed to shm_open %s: %s\n", telemetry.name, strerror(errno));
+		return false;
+	}
+
+	if (ftruncate(fd, sizeof(TelemetryBlock)) < 0) {
+		fprintf(stderr, "[TELEMETRY]: Failed to ftruncate: %s\n", strerror(errno));
+		close(fd);
+		shm_unlink(telemetry.name);
+		return false;
+	}
+
+	auto mem = mmap(0, sizeof(TelemetryBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "[TELEMETRY]: Failed to mmap: %s\n", strerror(errno));
+		shm_unlink(telemetry.name);
+		return false;
+	}
+
+	telemetry.block = (TelemetryBlock*)mem;
+	telemetry.block->block_size = sizeof(TelemetryBlock);
+	telemetry.block->pid = getpid();
+	telemetry.block->history_count = telemetry_history_count;
+	telemetry.block->version = telemetry_version;
+	__atomic_store_n(&telemetry.block->magic, telemetry_magic, __ATOMIC_RELEASE); // Last, readers check it first
+
+	printf("[TELEMETRY]: Publishing to %s\n", telemetry.name);
+	return true;
+}
+
+void telemetry_publish(Telemetry& telemetry, const TelemetryFrame& frame)
+{
+	auto block = telemetry.block;
+	if (!block)
+		return;
+
+	const auto sequence = block->sequence;
+	__atomic_store_n(&block->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	block->latest = frame;
+	block->history[frame.frame_index % telemetry_history_count] = frame;
+
+	__atomic_store_n(&block->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void telemetry_close(Telemetry& telemetry)
+{
+	if (!telemetry.block)
+		return;
+
+	munmap(telemetry.block, sizeof(TelemetryBlock));
+	shm_unlink(telemetry.name);
+	telemetry.block = 0;
+}
@@ -0,0 +1,162 @@
+#include <malloc.h>
+#include <string.h>
+
+#include "game.h"
+#include "linux_log.h"
+#include "simd.h"
+#include "types.h"
+
+// Nearest-neighbour upscale of a small render target into the window sized image.
+// Source columns are looked up from a precomputed table and rows that map to the same source row are copied
+// from the row above, so the cost is roughly one gather per destination pixel of distinct rows.
+// Indexed sources are expanded through their palette one source row at a time and then scaled as 32-bit.
+
+struct Upscaler {
+	int src_width, src_height;
+	int dst_width, dst_height;
+	i32* src_x; // Source column of every destination column
+	u32* expanded_row; // One source row of an indexed source after palette expansion
+	bool use_avx2;
+};
+
+// Returns false when the tables can't be allocated, the next call tries again
+bool upscaler_prepare(Upscaler& upscaler, const int src_width, const int src_height, const int dst_width, const int dst_height)
+{
+	if (upscaler.src_x && upscaler.src_width == src_width && upscaler.src_height == src_height
+		&& upscaler.dst_width == dst_width && upscaler.dst_height == dst_height)
+		return true;
+
+	free(upscaler.src_x);
+	free(upscaler.expanded_row);
+	upscaler.src_width = src_width;
+	upscaler.src_height = src_height;
+	upscaler.dst_width = dst_width;
+	upscaler.dst_height = dst_height;
+	upscaler.use_avx2 = cpu_has_avx2();
+
+	upscaler.src_x = (i32*)calloc(dst_width, sizeof(i32));
+	upscaler.expanded_row = (u32*)calloc(src_width, sizeof(u32));
+	if (!upscaler.src_x || !upscaler.expanded_row) {
+		LOG_ERROR("[UPSCALE]: Failed to allocate the tables for %ix%i to %ix%i\n", src_width, src_height, dst_width, dst_height);
+		free(upscaler.src_x);
+		free(upscaler.expanded_row);
+		upscaler.src_x = 0;
+		upscaler.expanded_row = 0;
+		return false;
+	}
+	for (int x = 0; x < dst_width; x++) {
+		upscaler.src_x[x] = (i32)((i64)x * src_width / dst_width);
+	}
+	return true;
+}
+
+template<typename Format>
+void upscale_row(const Upscaler& upscaler, const u8* const src, u8* const dst)
+{
+	for (int x = 0; x < upscaler.dst_width; x++) {
+		Format::store(dst + x * Format::bytes, Format::load(src + upscaler.src_x[x] * Format::bytes));
+	}
+}
+
+// 32-bit pixels only
+__attribute__((target("avx2"))) void upscale_row_avx2(const Upscaler& upscaler, const u8* const src_bytes, u8* const dst_bytes)
+{
+	const auto src = (const u32*)src_bytes;
+	const auto dst = (u32*)dst_bytes;
+	int x = 0;
+	for (; x + 8 <= upscaler.dst_width; x += 8) {
+		const auto indices = _mm256_loadu_si256((const __m256i*)(upscaler.src_x + x));
+		const auto pixels = _mm256_i32gather_epi32((const int*)src, indices, 4);
+		_mm256_storeu_si256((__m256i*)(dst + x), pixels);
+	}
+	for (; x < upscaler.dst_width; x++) {
+		dst[x] = src[upscaler.src_x[x]];
+	}
+}
+
+// src and the destination share src.format, the row kernel is picked once per frame
+template<typename Format>
+void upscale_rows(const Upscaler& upscaler, const GameScreenBuffer& src, char* const dst, const int dst_pitch, const bool use_avx2)
+{
+	const auto src_pitch = src.width * Format::bytes;
+	int prev_src_y = -1;
+	for (int y = 0; y < upscaler.dst_height; y++) {
+		const auto src_y = (int)((i64)y * upscaler.src_height / upscaler.dst_height);
+		const auto dst_row = (u8*)dst + y * dst_pitch;
+		if (src_y == prev_src_y) {
+			memcpy(dst_row, dst_row - dst_pitch, upscaler.dst_width * Format::bytes);
+			continue;
+		}
+
+		const auto src_row = (const u8*)src.buffer + src_y * src_pitch;
+		if (use_avx2)
+			upscale_row_avx2(upscaler, src_row, dst_row);
+		else
+			upscale_row<Format>(upscaler, src_row, dst_row);
+		prev_src_y = src_y;
+	}
+}
+
+// The destination is 32-bit
+void upscale_indexed(const Upscaler& upscaler, const GameScreenBuffer& src, char* const dst, const int dst_pitch)
+{
+	if (upscaler.src_width == upscaler.dst_width && upscaler.src_height == upscaler.dst_height) {
+		palette_expand(src, dst, dst_pitch, upscaler.use_avx2);
+		return;
+	}
+
+	int prev_src_y = -1;
+	for (int y = 0; y < upscaler.dst_height; y++) {
+		const auto src_y = (int)((i64)y * upscaler.src_height / upscaler.dst_height);
+		const auto dst_row = (u8*)dst + y * dst_pitch;
+		if (src_y == prev_src_y) {
+			memcpy(dst_row, dst_row - dst_pitch, upscaler.dst_width * sizeof(u32));
+			continue;
+		}
+
+		const auto src_row = (const u8*)src.buffer + src_y * src.width;
+		const auto expanded = (const u8*)upscaler.expanded_row;
+		if (upscaler.use_avx2) {
+			palette_expand_row_avx2(src_row, upscaler.expanded_row, src.width, src.palette);
+			upscale_row_avx2(upscaler, expanded, dst_row);
+		} else {
+			palette_expand_row(src_row, upscaler.expanded_row, src.width, src.palette);
+			upscale_row<PixelBGRX32>(upscaler, expanded, dst_row);
+		}
+		prev_src_y = src_y;
+	}
+}
+
+void upscale_nearest(const Upscaler& upscaler, const GameScreenBuffer& src, char* const dst, const int dst_pitch)
+{
+	switch (src.format) {
+	case PixelFormat_BGRX32:
+		upscale_rows<PixelBGRX32>(upscaler, src, dst, dst_pitch, upscaler.use_avx2);
+		break;
+	case PixelFormat_BGR24:
+		upscale_rows<PixelBGR24>(upscaler, src, dst, dst_pitch, false);
+		break;
+	case PixelFormat_RGB565:
+		upscale_rows<PixelRGB565>(upscaler, src, dst, dst_pitch, false);
+		break;
+	case PixelFormat_Indexed8:
+		upscale_indexed(upscaler, src, dst, dst_pitch);
+		break;
+	}
+}
+
+// Without upscaler tables: copies the part of src that fits into the top-left corner of the destination.
+// Indexed sources are expanded through their palette, the destination is then 32-bit.
+void upscale_unscaled(const GameScreenBuffer& src, char* const dst, const int dst_pitch, const int dst_width, const int dst_height)
+{
+	const auto width = src.width < dst_width ? src.width : dst_width;
+	const auto height = src.height < dst_height ? src.height : dst_height;
+	for (int y = 0; y < height; y++) {
+		const auto src_row = (const u8*)src.buffer + y * src.pitch();
+		const auto dst_row = dst + y * dst_pitch;
+		if (src.format == PixelFormat_Indexed8)
+			palette_expand_row(src_row, (u32*)dst_row, width, src.palette);
+		else
+			memcpy(dst_row, src_row, width * src.pixel_bytes());
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "types.h"
+#include <string.h>
+
+const u64 cache_line_size = 64;
+
+// Linear allocator over a block handed out by the platform (perm_storage or trans_storage), never calls malloc
+struct MemoryArena {
+	u8* base;
+	u64 size;
+	u64 used;
+};
+
+inline void arena_init(MemoryArena& arena, void* const base, const u64 size)
+{
+	arena.base = (u8*)base;
+	arena.size = size;
+	arena.used = 0;
+}
+
+inline void* arena_push_size(MemoryArena& arena, const u64 size, const u64 align = cache_line_size)
+{
+	const auto address = (u64)(arena.base + arena.used);
+	const auto padding = (align - (address & (align - 1))) & (align - 1);
+	assert(arena.used + padding + size <= arena.size);
+	if (arena.used + padding + size > arena.size)
+		return 0;
+
+	auto result = arena.base + arena.used + padding;
+	arena.used += padding + size;
+	return result;
+}
+
+template<typename T>
+T* arena_push_array(MemoryArena& arena, const u64 count, const u64 align = cache_line_size)
+{
+	return (T*)arena_push_size(arena, count * sizeof(T), align);
+}
+
+template<typename T>
+T* arena_push_struct(MemoryArena& arena, const u64 align = alignof(T))
+{
+	auto result = (T*)arena_push_size(arena, sizeof(T), align);
+	if (result)
+		memset((void*)result, 0, sizeof(T));
+	return result;
+}
+
+inline void arena_reset(MemoryArena& arena)
+{
+	arena.used = 0;
+}
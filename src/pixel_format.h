@@ -0,0 +1,95 @@
+#pragma once
+#include "types.h"
+
+enum PixelFormat {
+	PixelFormat_BGRX32, // Zero, so buffers that don't say otherwise are 32-bit
+	PixelFormat_BGR24, // Packed, 3 bytes per pixel
+	PixelFormat_RGB565,
+	PixelFormat_Indexed8, // Palette indices, expanded to the window's pixels at present
+};
+
+// One type per PixelFormat, drawing code is a template over these so the pixel size, addressing and colour packing
+// are all compile-time constants in the inner loops. Colours are 0xRRGGBB and get packed once per primitive,
+// unpack goes back to 0xRRGGBB for the few places that blend with what's already there.
+
+struct PixelBGRX32 {
+	typedef u32 Packed;
+	static const int bytes = 4;
+	static Packed pack(const u32 rgb) { return rgb; }
+	static u32 unpack(const Packed value) { return value & 0xFFFFFF; }
+	static Packed load(const u8* const p) { return *(const u32*)p; }
+	static void store(u8* const p, const Packed value) { *(u32*)p = value; }
+};
+
+struct PixelBGR24 {
+	typedef u32 Packed;
+	static const int bytes = 3;
+	static Packed pack(const u32 rgb) { return rgb & 0xFFFFFF; }
+	static u32 unpack(const Packed value) { return value; }
+	static Packed load(const u8* const p) { return p[0] | (p[1] << 8) | (p[2] << 16); }
+	static void store(u8* const p, const Packed value)
+	{
+		p[0] = (u8)value;
+		p[1] = (u8)(value >> 8);
+		p[2] = (u8)(value >> 16);
+	}
+};
+
+struct PixelRGB565 {
+	typedef u16 Packed;
+	static const int bytes = 2;
+	static Packed pack(const u32 rgb) { return (Packed)(((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F)); }
+	static u32 unpack(const Packed value)
+	{
+		const u32 r = (value >> 11) & 0x1F, g = (value >> 5) & 0x3F, b = value & 0x1F;
+		return (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+	}
+	static Packed load(const u8* const p) { return *(const u16*)p; }
+	static void store(u8* const p, const Packed value) { *(u16*)p = value; }
+};
+
+inline u32 pixel_rgb332_to_rgb(const u8 index)
+{
+	const u32 r = (index >> 5) * 255 / 7;
+	const u32 g = ((index >> 2) & 7) * 255 / 7;
+	const u32 b = (index & 3) * 255 / 3;
+	return (r << 16) | (g << 8) | b;
+}
+
+// Colours are quantized to RGB332 indices, which the default palette maps back to (roughly) the same colours
+struct PixelIndexed8 {
+	typedef u8 Packed;
+	static const int bytes = 1;
+	static Packed pack(const u32 rgb) { return (Packed)(((rgb >> 16) & 0xE0) | ((rgb >> 11) & 0x1C) | ((rgb >> 6) & 0x03)); }
+	static u32 unpack(const Packed value) { return pixel_rgb332_to_rgb(value); } // Assumes the default palette
+	static Packed load(const u8* const p) { return *p; }
+	static void store(u8* const p, const Packed value) { *p = value; }
+};
+
+inline int pixel_format_bits(const PixelFormat format)
+{
+	switch (format) {
+	case PixelFormat_BGR24:
+		return 24;
+	case PixelFormat_RGB565:
+		return 16;
+	case PixelFormat_Indexed8:
+		return 8;
+	default:
+		return 32;
+	}
+}
+
+inline const char* pixel_format_name(const PixelFormat format)
+{
+	switch (format) {
+	case PixelFormat_BGR24:
+		return "BGR24";
+	case PixelFormat_RGB565:
+		return "RGB565";
+	case PixelFormat_Indexed8:
+		return "Indexed8";
+	default:
+		return "BGRX32";
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include "types.h"
+
+// Wider paths are compiled with __attribute__((target(...))) and picked at runtime, so the
+// build itself stays baseline x86-64 (SSE2)
+inline bool cpu_has_avx2()
+{
+	u32 a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX))
+		return false;
+
+	// The OS has to save the YMM registers too
+	u32 xcr0_lo, xcr0_hi;
+	asm volatile("xgetbv"
+				 : "=a"(xcr0_lo), "=d"(xcr0_hi)
+				 : "c"(0));
+	if ((xcr0_lo & 6) != 6)
+		return false;
+
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return false;
+	return b & bit_AVX2;
+}
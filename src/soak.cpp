@@ -0,0 +1,405 @@
+#include <errno.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "game.cpp"
+#include "game.h"
+#include "linux_file_io.cpp"
+#include "linux_state_hash.cpp"
+#include "types.h"
+
+// Headless soak test: soak [--instances N] [--seconds S] [--frames F] [--seed X] [--size WxH] [--script FILE]
+//                           [--record-hashes PREFIX | --check-hashes PREFIX]
+// Every instance is a forked process with its own GameMemory and buffers, so an assert or a crash takes down only
+// that instance and gets reported with the seed that reproduces it. Instances run update and render back to back
+// with fuzzed input (or a looped script) and are restarted with a new seed until the time runs out.
+// The job table is left empty, the game then runs its parallel loops inline and each core hosts one instance.
+// With hashes every run writes per-frame state hashes to PREFIX.<seed>, or stops at the first frame that differs from
+// them, so rerunning with the same --seed checks the game is still deterministic.
+
+const auto soak_max_instances = 256;
+const auto soak_max_script_steps = 4096;
+const auto soak_sound_frames = 48000 / 60;
+const auto soak_max_updates_per_frame = 3;
+
+struct SoakScriptStep {
+	u32 frame_count;
+	u32 buttons; // Bit per GameCtrlInput button of the keyboard controller
+	float stick_x, stick_y; // First joystick
+};
+
+struct SoakScript {
+	u32 step_count;
+	SoakScriptStep steps[soak_max_script_steps];
+};
+
+// One per instance slot, in memory shared with the children
+struct SoakSlot {
+	pid_t pid;
+	u32 seed;
+	u64 frame_count; // Written by the child every frame, read by the parent when it dies
+	u64 perm_high_water;
+	u64 trans_high_water;
+	i64 worst_frame_ns;
+	u64 worst_frame_index;
+	bool has_finished;
+	bool has_diverged; // From the reference hashes
+	bool should_stop; // Set by the parent on SIGINT
+};
+
+struct SoakOptions {
+	int instance_count;
+	int seconds;
+	u64 frames_per_run;
+	u32 seed;
+	int width, height;
+	SoakScript* script;
+	const char* hash_prefix;
+	bool is_checking_hashes;
+};
+
+i64 get_ns_time()
+{
+	timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000000000ll + spec.tv_nsec;
+}
+
+auto is_running = true;
+
+void sig_handler(int sig)
+{
+	is_running = false;
+}
+
+bool load_script(SoakScript& script, const char* const filename)
+{
+	auto file = fopen(filename, "r");
+	if (!file) {
+		fprintf(stderr, "[SOAK]: Failed to open %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+
+	// <frames> <buttons from "udlrLR", or -> <stick x> <stick y>, # starts a comment
+	char line[256];
+	script.step_count = 0;
+	while (fgets(line, sizeof(line), file) && script.step_count < soak_max_script_steps) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		char buttons[16];
+		auto& step = script.steps[script.step_count];
+		if (sscanf(line, "%u %15s %f %f", &step.frame_count, buttons, &step.stick_x, &step.stick_y) != 4) {
+			fprintf(stderr, "[SOAK]: Bad script line: %s", line);
+			fclose(file);
+			return false;
+		}
+
+		const char button_names[] = "udlrLR"; // @Volatile order of GameCtrlInput::buttons
+		step.buttons = 0;
+		for (auto c = buttons; *c; c++) {
+			const auto button = strchr(button_names, *c);
+			if (button)
+				step.buttons |= 1 << (button - button_names);
+		}
+		script.step_count++;
+	}
+	fclose(file);
+	return script.step_count > 0;
+}
+
+void set_button(GameBtnState& button, const bool is_down)
+{
+	button.half_trans_count = button.ended_down != is_down;
+	button.ended_down = is_down;
+}
+
+void fuzz_input(GameInput& input, u32& random)
+{
+	auto& keyboard = input.ctrls[0];
+	for (auto& button : keyboard.buttons) {
+		const auto toggle = random_next(random) % 16 == 0;
+		set_button(button, button.ended_down != toggle);
+	}
+
+	// Held for a while, with the extremes picked more often than their share
+	auto& joy = input.ctrls[max_keyboard_count];
+	joy.is_analog = true;
+	if (random_next(random) % 32 == 0) {
+		const auto pick = random_next(random) % 4;
+		joy.end_x = pick == 0 ? 0.f : (pick == 1 ? (random_next(random) & 1 ? 1.f : -1.f) : random_bilateral(random));
+		joy.end_y = pick == 0 ? 0.f : (pick == 1 ? (random_next(random) & 1 ? 1.f : -1.f) : random_bilateral(random));
+	}
+}
+
+void script_input(GameInput& input, const SoakScript& script, const u64 frame_index)
+{
+	u64 script_frames = 0;
+	for (u32 i = 0; i < script.step_count; i++) {
+		script_frames += script.steps[i].frame_count;
+	}
+
+	auto frame = script_frames ? frame_index % script_frames : 0;
+	for (u32 i = 0; i < script.step_count; i++) {
+		const auto& step = script.steps[i];
+		if (frame >= step.frame_count) {
+			frame -= step.frame_count;
+			continue;
+		}
+
+		auto& keyboard = input.ctrls[0];
+		for (u32 button = 0; button < sizeof(keyboard.buttons) / sizeof(keyboard.buttons[0]); button++) {
+			set_button(keyboard.buttons[button], step.buttons & (1 << button));
+		}
+		auto& joy = input.ctrls[max_keyboard_count];
+		joy.is_analog = true;
+		joy.end_x = step.stick_x;
+		joy.end_y = step.stick_y;
+		return;
+	}
+}
+
+// Runs in the child, never returns
+void run_instance(SoakSlot& slot, const SoakOptions& options, const i64 deadline_ns)
+{
+	// Same address in every run, perm_storage holds pointers into itself and gets hashed
+	const auto base_addr = (void*)GiB(3);
+	GameMemory memory = {};
+	memory.perm_storage_size = MiB(64);
+	memory.trans_storage_size = GiB(2);
+	memory.perm_storage = mmap(base_addr, memory.perm_storage_size + memory.trans_storage_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (memory.perm_storage == MAP_FAILED) {
+		fprintf(stderr, "[SOAK]: Failed to allocate game memory: %s\n", strerror(errno));
+		_exit(2);
+	}
+	memory.trans_storage = (u8*)memory.perm_storage + memory.perm_storage_size;
+
+	GameScreenBuffer buffer = { .width = options.width, .height = options.height, .pixel_bits = 32 };
+	buffer.buffer = (char*)aligned_alloc(64, buffer.pitch() * buffer.height);
+	auto samples = (i16*)calloc(soak_sound_frames * 2, sizeof(i16));
+	if (!buffer.buffer || !samples) {
+		fprintf(stderr, "[SOAK]: Failed to allocate buffers\n");
+		_exit(2);
+	}
+
+	StateHashLog hash_log = {};
+	if (options.hash_prefix) {
+		if (memory.perm_storage != base_addr)
+			fprintf(stderr, "[SOAK]: Game memory is at %p instead of %p, hashes won't match other runs\n", memory.perm_storage, base_addr);
+		char filename[512];
+		snprintf(filename, sizeof(filename), "%s.%08x", options.hash_prefix, slot.seed);
+		if (!state_hash_open(hash_log, filename, options.is_checking_hashes) && !options.is_checking_hashes)
+			_exit(2); // A seed that wasn't recorded just runs unchecked
+	}
+
+	GameInput input = {};
+	auto random = slot.seed;
+	for (u64 frame = 0; frame < options.frames_per_run; frame++) {
+		if (frame % 64 == 0 && (get_ns_time() > deadline_ns || __atomic_load_n(&slot.should_stop, __ATOMIC_RELAXED)))
+			break;
+
+		if (options.script)
+			script_input(input, *options.script, frame);
+		else
+			fuzz_input(input, random);
+
+		// Also exercise frames that need no update and frames that catch up
+		const auto update_count = options.script ? 1 : random_next(random) % (soak_max_updates_per_frame + 1);
+
+		const auto frame_start = get_ns_time();
+		for (u32 i = 0; i < update_count; i++) {
+			game_update(memory, input, game_update_dt);
+		}
+		GameSoundBuffer sound_buffer = { .frame_rate = 48000, .channel_num = 2, .sample_buffer = samples, .frame_count = soak_sound_frames };
+		game_render(memory, buffer, sound_buffer, options.script ? 0.f : random_unilateral(random));
+		const auto frame_ns = get_ns_time() - frame_start;
+		if (!state_hash_step(hash_log, memory, buffer, sound_buffer)) {
+			__atomic_store_n(&slot.frame_count, frame, __ATOMIC_RELAXED);
+			slot.has_diverged = true;
+			_exit(3);
+		}
+
+		if (frame_ns > slot.worst_frame_ns) {
+			slot.worst_frame_ns = frame_ns;
+			slot.worst_frame_index = frame;
+		}
+		if (memory.perm_storage_used > slot.perm_high_water)
+			slot.perm_high_water = memory.perm_storage_used;
+		if (memory.trans_storage_used > slot.trans_high_water)
+			slot.trans_high_water = memory.trans_storage_used;
+		__atomic_store_n(&slot.frame_count, frame + 1, __ATOMIC_RELAXED);
+	}
+
+	state_hash_close(hash_log);
+	slot.has_finished = true;
+	_exit(0);
+}
+
+bool start_instance(SoakSlot& slot, const SoakOptions& options, const u32 seed, const i64 deadline_ns)
+{
+	memset((void*)&slot, 0, sizeof(slot));
+	slot.seed = seed;
+
+	fflush(stdout);
+	const auto pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "[SOAK]: Failed to fork: %s\n", strerror(errno));
+		return false;
+	}
+	if (pid == 0) {
+		signal(SIGINT, SIG_IGN); // The parent tells it to stop through the slot
+		run_instance(slot, options, deadline_ns);
+	}
+	slot.pid = pid;
+	return true;
+}
+
+// Reports how an instance ended, returns false for a crash or a failed assert
+bool report_instance(const SoakSlot& slot, const int status)
+{
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && slot.has_finished) {
+		printf("[SOAK]: Seed 0x%08x ran %lu frames, perm %.1f MiB, trans %.1f MiB, worst frame %.2fms at %lu\n", slot.seed,
+			slot.frame_count, (double)slot.perm_high_water / MiB(1), (double)slot.trans_high_water / MiB(1), slot.worst_frame_ns / 1e6,
+			slot.worst_frame_index);
+		return true;
+	}
+
+	if (slot.has_diverged)
+		printf("[SOAK]: FAILED seed 0x%08x at frame %lu: differs from the reference hashes\n", slot.seed, slot.frame_count);
+	else if (WIFSIGNALED(status))
+		printf("[SOAK]: FAILED seed 0x%08x at frame %lu: %s\n", slot.seed, slot.frame_count, strsignal(WTERMSIG(status)));
+	else
+		printf("[SOAK]: FAILED seed 0x%08x at frame %lu: exit code %i\n", slot.seed, slot.frame_count, WEXITSTATUS(status));
+	return false;
+}
+
+int main(int argc, char** argv)
+{
+	SoakOptions options = {};
+	options.instance_count = sysconf(_SC_NPROCESSORS_ONLN);
+	options.seconds = 60;
+	options.frames_per_run = 100000;
+	options.seed = (u32)time(0);
+	options.width = 1280;
+	options.height = 720;
+
+	for (int i = 1; i < argc; i++) {
+		const auto has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--instances") == 0 && has_value) {
+			options.instance_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--seconds") == 0 && has_value) {
+			options.seconds = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+			options.frames_per_run = strtoull(argv[++i], 0, 0);
+		} else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+			options.seed = (u32)strtoul(argv[++i], 0, 0);
+		} else if (strcmp(argv[i], "--size") == 0 && has_value) {
+			if (sscanf(argv[++i], "%ix%i", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+				fprintf(stderr, "Invalid --size %s, expected WxH\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--script") == 0 && has_value) {
+			options.script = (SoakScript*)malloc(sizeof(SoakScript));
+			if (!options.script || !load_script(*options.script, argv[++i]))
+				return 1;
+		} else if ((strcmp(argv[i], "--record-hashes") == 0 || strcmp(argv[i], "--check-hashes") == 0) && has_value) {
+			options.is_checking_hashes = strcmp(argv[i], "--check-hashes") == 0;
+			options.hash_prefix = argv[++i];
+		} else {
+			fprintf(stderr, "Unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+	options.seed |= 1; // xorshift can't start from 0, stepping by 2 keeps every seed odd and distinct
+	if (options.instance_count < 1)
+		options.instance_count = 1;
+	if (options.instance_count > soak_max_instances)
+		options.instance_count = soak_max_instances;
+
+	signal(SIGINT, sig_handler);
+
+	auto slots = (SoakSlot*)mmap(0, soak_max_instances * sizeof(SoakSlot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (slots == MAP_FAILED) {
+		fprintf(stderr, "[SOAK]: Failed to mmap the shared slots: %s\n", strerror(errno));
+		return 1;
+	}
+
+	printf("[SOAK]: %i instances for %is, %lu frames per run, first seed 0x%08x%s\n", options.instance_count, options.seconds,
+		options.frames_per_run, options.seed, options.script ? ", scripted input" : "");
+
+	const auto start_ns = get_ns_time();
+	const auto deadline_ns = start_ns + options.seconds * 1000000000ll;
+	auto seed = options.seed;
+	auto running_count = 0;
+	for (int i = 0; i < options.instance_count; i++) {
+		if (start_instance(slots[i], options, seed, deadline_ns))
+			running_count++;
+		seed += 2;
+	}
+
+	u64 finished_frames = 0;
+	u64 run_count = 0;
+	u64 failure_count = 0;
+	auto last_report_ns = start_ns;
+	u64 last_report_frames = 0;
+	while (running_count > 0) {
+		int status;
+		const auto pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0) {
+			for (int i = 0; i < options.instance_count; i++) {
+				auto& slot = slots[i];
+				if (slot.pid != pid)
+					continue;
+
+				run_count++;
+				finished_frames += slot.frame_count;
+				if (!report_instance(slot, status))
+					failure_count++;
+
+				slot.pid = 0;
+				running_count--;
+				if (is_running && get_ns_time() < deadline_ns) {
+					if (start_instance(slot, options, seed, deadline_ns))
+						running_count++;
+					seed += 2;
+				}
+			}
+			continue;
+		}
+		if (pid < 0 && errno != EINTR)
+			break;
+
+		if (!is_running) {
+			for (int i = 0; i < options.instance_count; i++) {
+				__atomic_store_n(&slots[i].should_stop, true, __ATOMIC_RELAXED);
+			}
+		}
+
+		usleep(10000);
+		const auto now = get_ns_time();
+		if (now - last_report_ns >= 1000000000ll) {
+			auto total_frames = finished_frames;
+			for (int i = 0; i < options.instance_count; i++) {
+				if (slots[i].pid)
+					total_frames += __atomic_load_n(&slots[i].frame_count, __ATOMIC_RELAXED);
+			}
+			printf("[SOAK]: %.0f frames/s, %lu frames, %lu failures\n", (total_frames - last_report_frames) * 1e9 / (now - last_report_ns),
+				total_frames, failure_count);
+			last_report_ns = now;
+			last_report_frames = total_frames;
+		}
+	}
+
+	const auto elapsed_ns = get_ns_time() - start_ns;
+	printf("[SOAK]: %lu runs, %lu frames in %.1fs (%.0f frames/s), %lu failures\n", run_count, finished_frames, elapsed_ns / 1e9,
+		finished_frames * 1e9 / elapsed_ns, failure_count);
+	return failure_count ? 1 : 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "types.h"
+
+// Layout of the shared-memory segment "/game_telemetry.<pid>" the platform publishes every frame.
+// Readers map it read-only and use the seqlock: read sequence, skip while it is odd, copy, then re-read
+// sequence and retry if it changed. Every field is little-endian and naturally aligned, bump
+// telemetry_version whenever anything here changes.
+
+const u32 telemetry_magic = 0x4D4C4554; // "TELM"
+const u32 telemetry_version = 1;
+const auto telemetry_history_count = 256;
+const auto telemetry_name_format = "/game_telemetry.%d";
+
+struct TelemetryFrame {
+	u64 frame_index;
+	i64 frame_ns; // Wall time of the whole frame
+	u64 frame_cycles; // __rdtsc delta of the whole frame
+	i64 audio_delay; // snd_pcm_avail_delay, in frames
+	i64 audio_avail;
+	u64 audio_underruns; // Since startup
+	u32 input_events; // X11 and joystick events handled this frame
+	u32 update_count; // Fixed steps simulated this frame
+	u64 perm_storage_high_water; // Bytes
+	u64 trans_storage_high_water;
+};
+
+struct TelemetryBlock {
+	u32 magic;
+	u32 version;
+	u32 block_size; // sizeof(TelemetryBlock)
+	i32 pid;
+	u32 sequence; // Seqlock, odd while the platform is writing
+	u32 history_count;
+	TelemetryFrame latest;
+	TelemetryFrame history[telemetry_history_count]; // Indexed by frame_index % history_count
+};
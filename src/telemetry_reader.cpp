@@ -0,0 +1,96 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+#include "types.h"
+
+// Prints the live metrics of a running game: telemetry_reader <pid> [interval_ms]
+
+auto is_running = true;
+
+void sig_handler(int sig)
+{
+	is_running = false;
+}
+
+bool read_latest(const TelemetryBlock& block, TelemetryFrame& frame)
+{
+	for (int attempt = 0; attempt < 1000; attempt++) {
+		const auto begin = __atomic_load_n(&block.sequence, __ATOMIC_ACQUIRE);
+		if (begin & 1)
+			continue;
+
+		memcpy(&frame, (const void*)&block.latest, sizeof(frame));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&block.sequence, __ATOMIC_RELAXED) == begin)
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <pid> [interval_ms]\n", argv[0]);
+		return 1;
+	}
+
+	const auto pid = atoi(argv[1]);
+	const auto interval_ms = argc > 2 ? atoi(argv[2]) : 500;
+
+	char name[64];
+	snprintf(name, sizeof(name), telemetry_name_format, pid);
+	const auto fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(TelemetryBlock)) {
+		fprintf(stderr, "%s is too small for this reader's layout\n", name);
+		return 1;
+	}
+
+	auto mem = mmap(0, sizeof(TelemetryBlock), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "Failed to mmap: %s\n", strerror(errno));
+		return 1;
+	}
+
+	const auto& block = *(const TelemetryBlock*)mem;
+	if (__atomic_load_n(&block.magic, __ATOMIC_ACQUIRE) != telemetry_magic || block.version != telemetry_version) {
+		fprintf(stderr, "%s has magic %08x version %u, expected %08x version %u\n", name, block.magic, block.version, telemetry_magic, telemetry_version);
+		return 1;
+	}
+
+	signal(SIGINT, sig_handler);
+	printf("%10s %9s %8s %8s %8s %9s %6s %7s %10s %10s\n", "frame", "ms", "mcycles", "delay", "avail", "underruns", "events", "updates", "perm KiB", "trans KiB");
+
+	u64 last_frame = ~0ull;
+	while (is_running) {
+		TelemetryFrame frame;
+		if (read_latest(block, frame) && frame.frame_index != last_frame) {
+			printf("%10lu %9.2f %8.2f %8ld %8ld %9lu %6u %7u %10lu %10lu\n", frame.frame_index, (double)frame.frame_ns / 1e6,
+				(double)frame.frame_cycles / 1e6, frame.audio_delay, frame.audio_avail, frame.audio_underruns, frame.input_events,
+				frame.update_count, frame.perm_storage_high_water / 1024, frame.trans_storage_high_water / 1024);
+			last_frame = frame.frame_index;
+			fflush(stdout);
+		}
+
+		timespec wait = { .tv_sec = interval_ms / 1000, .tv_nsec = (interval_ms % 1000) * 1000000l };
+		nanosleep(&wait, 0);
+	}
+
+	munmap(mem, sizeof(TelemetryBlock));
+}
@@ -1,6 +1,5 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
-#include <X11/extensions/XShm.h>
 #include <malloc.h>
 #include <signal.h>
 #include <sys/mman.h>
@@ -13,79 +12,69 @@
 #include "game.cpp"
 #include "game.h"
 #include "linux_alsa.cpp"
+#include "linux_capture.cpp"
 #include "linux_file_io.cpp"
+#include "linux_frame_stats.cpp"
+#include "linux_input_latency.cpp"
+#include "linux_jobs.cpp"
+#include "linux_log.cpp"
 #include "linux_joystick.cpp"
+#include "linux_palette.cpp"
+#include "linux_perf.cpp"
+#include "linux_rewind.cpp"
+#include "linux_state_hash.cpp"
+#include "linux_speculate.cpp"
+#include "linux_telemetry.cpp"
+#include "linux_upscale.cpp"
 #include "types.h"
+#include "x11_present.cpp"
 
 #define ALSA_DEBUG 0
 #define FPS 1
 
-auto use_xshm = true;
+const i64 game_update_ns = 1000000000 / game_update_hz;
+const auto max_updates_per_frame = 8; // Past this the simulation slows down instead of spiraling
+const auto frame_stats_filename = "frame_stats.bin";
 
-int get_ns_time()
+#if INTERNAL
+const auto rewind_history_size = MiB(16);
+const auto rewind_max_snapshots = 1024;
+const auto rewind_snapshot_interval = 4; // Frames
+#endif
+
+// F forks a branch per entry, each holding that keyboard button (none for idle) for speculation_steps updates
+const auto speculation_steps = game_update_hz * 2;
+const char* const speculation_branch_names[] = { "idle", "up", "down", "left", "right", "lb", "rb" }; // @Volatile order of GameCtrlInput::buttons
+const auto speculation_branch_count = (int)(sizeof(speculation_branch_names) / sizeof(speculation_branch_names[0]));
+
+i64 get_ns_time()
 {
 	timespec spec;
 	clock_gettime(CLOCK_MONOTONIC, &spec);
-	return spec.tv_nsec;
+	return spec.tv_sec * 1000000000ll + spec.tv_nsec;
 }
 
-struct ScreenBuffer {
-	int width;
-	int height;
-	int pixel_bits;
-	char* buffer;
-	XImage* ximage;
-	XShmSegmentInfo shminfo;
-	int pixel_bytes() const
-	{
-		return pixel_bits / 8;
-	}
-	int byte_size() const { return width * height * pixel_bytes(); }
-	int pitch() const { return width * pixel_bytes(); }
-};
-
-void delete_screen_buffer(ScreenBuffer& buffer, Display* display)
+// Maps the visual and the server's pixmap format for its depth to one of the formats the game draws in
+bool x11_get_pixel_format(Display* display, const XVisualInfo& vinfo, PixelFormat& format)
 {
-	if (use_xshm) {
-		XShmDetach(display, &buffer.shminfo);
-		shmdt(buffer.shminfo.shmaddr);
+	int format_count;
+	auto formats = XListPixmapFormats(display, &format_count);
+	auto bits_per_pixel = 0;
+	for (int i = 0; i < format_count; i++) {
+		if (formats[i].depth == vinfo.depth)
+			bits_per_pixel = formats[i].bits_per_pixel;
 	}
-	XDestroyImage(buffer.ximage);
-}
-
-bool create_screen_buffer(ScreenBuffer& buffer, int width, int height, int pixel_bits, const XVisualInfo& vinfo, Display* display)
-{
-	buffer.width = width;
-	buffer.height = height;
-	buffer.pixel_bits = pixel_bits;
-
-	if (use_xshm) {
-		// TODO: Cant create a new shared buffer when resized, it crashes the app, maybe allocate a large one and use the portion needed
-		buffer.ximage = XShmCreateImage(display, vinfo.visual, vinfo.depth, ZPixmap, 0, &buffer.shminfo, width, height);
-		buffer.shminfo.shmid = shmget(IPC_PRIVATE, buffer.ximage->bytes_per_line * buffer.ximage->height, IPC_CREAT | 0777);
-		buffer.buffer = buffer.shminfo.shmaddr = buffer.ximage->data = (char*)shmat(buffer.shminfo.shmid, 0, 0);
-		buffer.shminfo.readOnly = 1;
-
-		if (!XShmAttach(display, &buffer.shminfo)) {
-			fprintf(stderr, "Failed to XShmAttach\n");
-			return 0;
-		}
-
-		shmctl(buffer.shminfo.shmid, IPC_RMID, 0); // Mark shared buffer for removal after process end; cant do on create_buffer because it crashes
-
-		printf("[MIT-SHM]: Shared memory KID=%d, at=%p\n", buffer.shminfo.shmid, buffer.shminfo.shmaddr);
-
-	} else {
-		buffer.buffer = (char*)malloc(buffer.byte_size());
-		if (!buffer.buffer) {
-			fprintf(stderr, "Failed to malloc\n");
-			return 0;
-		}
-
-		buffer.ximage = XCreateImage(display, vinfo.visual, vinfo.depth, ZPixmap, 0, buffer.buffer, width, height, pixel_bits, 0);
-	}
-
-	return 1;
+	XFree(formats);
+
+	if (bits_per_pixel == 32 && vinfo.red_mask == 0xFF0000 && vinfo.green_mask == 0xFF00 && vinfo.blue_mask == 0xFF)
+		format = PixelFormat_BGRX32;
+	else if (bits_per_pixel == 24 && vinfo.red_mask == 0xFF0000 && vinfo.green_mask == 0xFF00 && vinfo.blue_mask == 0xFF)
+		format = PixelFormat_BGR24;
+	else if (bits_per_pixel == 16 && vinfo.red_mask == 0xF800 && vinfo.green_mask == 0x07E0 && vinfo.blue_mask == 0x001F)
+		format = PixelFormat_RGB565;
+	else
+		return false;
+	return true;
 }
 
 bool get_keycode_state(Display* display, uint keycode)
@@ -98,23 +87,70 @@ bool get_keycode_state(Display* display, uint keycode)
 void write_sound_buffer(SoundOutput& sound_output, const int frames_to_write)
 {
 	auto frames_written = snd_pcm_writei(sound_output.handle, sound_output.sample_buffer, frames_to_write);
+	if (frames_written == -EPIPE)
+		sound_output.underrun_count++;
 	if (frames_written < 0) {
 		frames_written = snd_pcm_recover(sound_output.handle, frames_written, 0);
 	}
 
 	if (frames_written != frames_to_write) {
-		printf("[ALSA]: Only wrote %ld frames (expected %d frames)\n", frames_written, frames_to_write);
+		LOG_WARN("[ALSA]: Only wrote %ld frames (expected %d frames)\n", frames_written, frames_to_write);
 	}
 
 #if 0
 	if (frames_written > 0) {
 		snd_pcm_sframes_t delay, avail;
 		snd_pcm_avail_delay(sound_output.handle, &avail, &delay);
-		printf("[ALSA]: Frames after write: %ld (+%ld), Frame delay: %ld\n", sound_output.frame_count() - avail + frames_written, frames_written, delay);
+		LOG_DEBUG("[ALSA]: Frames after write: %ld (+%ld), Frame delay: %ld\n", sound_output.frame_count() - avail + frames_written, frames_written, delay);
 	}
 #endif
 }
 
+// Joystick probing and ALSA setup are independent of X, so they run on their own thread while the window maps and the
+// first frames render. The main loop leaves joysticks and audio alone until is_ready is set.
+struct DeviceStartup {
+	Joystick* joysticks;
+	JoystickInotify* joystick_inotify;
+	SoundOutput* sound_output;
+	AudioLatency* audio_latency;
+	i64 ready_ns;
+	bool is_ready; // Only touched atomically
+	pthread_t thread;
+};
+
+void* device_startup_proc(void* data)
+{
+	auto& startup = *(DeviceStartup*)data;
+	get_joysticks(startup.joysticks, max_joy_count);
+	joystick_inotify_setup(*startup.joystick_inotify);
+
+	auto& sound_output = *startup.sound_output;
+	if (!alsa_setup(sound_output)) {
+		LOG_ERROR("[ALSA]: Failed to init alsa\n");
+	}
+	audio_latency_setup(*startup.audio_latency, sound_output);
+	write_sound_buffer(sound_output, startup.audio_latency->target_frames);
+
+	startup.ready_ns = get_ns_time();
+	__atomic_store_n(&startup.is_ready, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void device_startup_join(DeviceStartup& startup)
+{
+	if (startup.thread)
+		pthread_join(startup.thread, 0);
+	startup.thread = 0;
+}
+
+// For failures in main once the startup thread runs, it may still be inside alsa_setup or the joystick probe
+int device_startup_fail(DeviceStartup& startup)
+{
+	device_startup_join(startup);
+	log_shutdown();
+	return 1;
+}
+
 void process_joy_axis_event(float state, float& new_state, const float& prev_state)
 {
 	new_state = state;
@@ -135,12 +171,15 @@ void process_keyboard_event(bool state, GameBtnState& new_state)
 }
 
 auto is_running = true;
+volatile sig_atomic_t should_report_frames = false; // SIGUSR1
+auto is_rewinding = false; // Held down with R in INTERNAL builds
+auto should_speculate = false; // Pressed F
 
 void x11_process_input_msgs(const XEvent& event, GameCtrlInput& keyboard_ctrl)
 {
 	switch (event.type) {
 	case ButtonPress: {
-		printf("You pressed a button at (%i, %i)\n", event.xbutton.x, event.xbutton.y);
+		LOG_DEBUG("You pressed a button at (%i, %i)\n", event.xbutton.x, event.xbutton.y);
 	} break;
 	case KeyRelease: // fall through
 	case KeyPress: {
@@ -183,6 +222,12 @@ void x11_process_input_msgs(const XEvent& event, GameCtrlInput& keyboard_ctrl)
 		case XK_e:
 			process_keyboard_event(is_pressed, keyboard_ctrl.rb);
 			break;
+		case XK_r:
+			is_rewinding = is_pressed;
+			break;
+		case XK_f:
+			should_speculate |= is_pressed;
+			break;
 		}
 
 	} break;
@@ -194,25 +239,89 @@ void sig_handler(int sig)
 	is_running = false;
 }
 
-int main()
+void report_sig_handler(int sig)
+{
+	should_report_frames = true;
+}
+
+int main(int argc, char** argv)
 {
+	const auto startup_ns = get_ns_time();
 	signal(SIGINT, sig_handler);
+	signal(SIGUSR1, report_sig_handler);
+
+	// --render-size WxH: the game renders at a fixed resolution that gets upscaled to whatever size the window has
+	// --capture NAME: records what gets presented and played to NAME.y4m and NAME.wav
+	auto render_width = 0;
+	auto render_height = 0;
+	const char* capture_name = 0;
+	auto preferred_depth = 24; // --depth 16 draws in RGB565 where the server has a 16-bit visual
+	auto is_indexed = false; // --indexed: the game draws palette indices that get expanded at present
+	auto is_measuring_latency = false; // --latency: input to present latency per input source, reported with the frame stats
+	auto log_level = LogLevel_Info; // --log-level debug|info|warn|error
+	auto present_backend = PresentBackend_Auto; // --present xshm|putimage|xdbe picks the backend instead of probing, to compare them on one server
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--render-size") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%ix%i", &render_width, &render_height) != 2 || render_width <= 0 || render_height <= 0) {
+				fprintf(stderr, "Invalid --render-size %s, expected WxH\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			capture_name = argv[++i];
+		} else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+			preferred_depth = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--indexed") == 0) {
+			is_indexed = true;
+		} else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+			if (!log_parse_level(argv[++i], log_level)) {
+				fprintf(stderr, "Invalid --log-level %s, expected debug, info, warn or error\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--latency") == 0) {
+			is_measuring_latency = true;
+		} else if (strcmp(argv[i], "--present") == 0 && i + 1 < argc) {
+			if (!present_backend_parse(argv[++i], present_backend)) {
+				fprintf(stderr, "Invalid --present %s, expected xshm, putimage, xdbe or auto\n", argv[i]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "Unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
 
-	auto display = XOpenDisplay(0);
+	log_setup(log_level);
 
-	if (!XShmQueryExtension(display)) {
-		fprintf(stderr, "No XShm support\n");
-		use_xshm = false;
+	Joystick joysticks[max_joy_count] = {};
+	JoystickInotify joystick_inotify;
+	SoundOutput sound_output = {};
+	sound_output.sample_buffer = (i16*)calloc(sound_output.byte_size(), 1); // @Volatile_bit_depth
+	AudioLatency audio_latency;
+	DeviceStartup device_startup = { .joysticks = joysticks, .joystick_inotify = &joystick_inotify, .sound_output = &sound_output, .audio_latency = &audio_latency };
+	if (pthread_create(&device_startup.thread, 0, device_startup_proc, &device_startup) != 0) {
+		fprintf(stderr, "Failed to start the device startup thread\n");
+		device_startup_proc(&device_startup);
+		device_startup.thread = 0;
 	}
+	auto has_devices = false; // Set once the startup thread is joined
+
+	auto display = XOpenDisplay(0);
 
 	auto screen = DefaultScreen(display);
 
 	XVisualInfo vinfo;
-	XMatchVisualInfo(display, screen, 24, TrueColor, &vinfo);
+	if (!XMatchVisualInfo(display, screen, preferred_depth, TrueColor, &vinfo) && !XMatchVisualInfo(display, screen, 24, TrueColor, &vinfo)
+		&& !XMatchVisualInfo(display, screen, 16, TrueColor, &vinfo)) {
+		fprintf(stderr, "No TrueColor visual\n");
+		return device_startup_fail(device_startup);
+	}
 
-	ScreenBuffer buffer = {};
-	if (!create_screen_buffer(buffer, 1280, 720, 32, vinfo, display))
-		return 1;
+	PixelFormat pixel_format;
+	if (!x11_get_pixel_format(display, vinfo, pixel_format)) {
+		fprintf(stderr, "Unsupported visual, depth %i\n", vinfo.depth);
+		return device_startup_fail(device_startup);
+	}
+	printf("Drawing in %s\n", pixel_format_name(pixel_format));
 
 	auto black_color = BlackPixel(display, screen);
 
@@ -222,23 +331,55 @@ int main()
 	XSetWindowAttributes attrs = { .background_pixel = black_color, .bit_gravity = StaticGravity, .event_mask = event_mask, .colormap = colormap };
 	unsigned long attrs_mask = CWColormap | CWBackPixel | CWEventMask | CWBitGravity;
 
-	auto window = XCreateWindow(display, DefaultRootWindow(display), 0, 0, buffer.width, buffer.height, 0, vinfo.depth, InputOutput, vinfo.visual, attrs_mask, &attrs);
+	auto window = XCreateWindow(display, DefaultRootWindow(display), 0, 0, 1280, 720, 0, vinfo.depth, InputOutput, vinfo.visual, attrs_mask, &attrs);
 	if (!window) {
 		fprintf(stderr, "Failed to XCreateWindow\n");
-		delete_screen_buffer(buffer, display);
-		return 1;
+		return device_startup_fail(device_startup);
 	}
 
-#if 0
-	XSizeHints hints = { .flags = PMinSize, .min_width = 800, .min_height = 500 };
-	XSetStandardProperties(display, window, "My game", 0, 0, 0, 0, &hints);
+	Presenter presenter;
+	if (!presenter_create(presenter, present_backend, display, window, vinfo, 1280, 720, pixel_format))
+		return device_startup_fail(device_startup);
+	const auto& buffer = presenter.buffer;
+
+	InputLatency input_latency = {};
+	if (is_measuring_latency && input_latency_setup(input_latency))
+		presenter.is_synced = true;
+
+	GameScreenBuffer render_target = {}; // Only used with --render-size or --indexed
+	u32 palette[256] = {};
+	Upscaler upscaler = {};
+	if (is_indexed && buffer.format != PixelFormat_BGRX32) {
+		fprintf(stderr, "--indexed needs a 32-bit visual, drawing in %s instead\n", pixel_format_name(buffer.format));
+		is_indexed = false;
+	}
+	if (render_width || is_indexed) {
+		render_target = { .width = render_width ? render_width : buffer.width, .height = render_height ? render_height : buffer.height };
+		render_target.format = is_indexed ? PixelFormat_Indexed8 : buffer.format;
+		render_target.pixel_bits = pixel_format_bits(render_target.format);
+		render_target.palette = is_indexed ? palette : 0;
+		render_target.buffer = (char*)aligned_alloc(64, render_target.pitch() * render_target.height);
+		if (!render_target.buffer) {
+			fprintf(stderr, "Failed to allocate the %ix%i render target\n", render_target.width, render_target.height);
+			return device_startup_fail(device_startup);
+		}
+		printf("Rendering at %ix%i in %s\n", render_target.width, render_target.height, pixel_format_name(render_target.format));
+	}
 
-#else
-	XSizeHints hints = { .flags = PMinSize | PMaxSize, .min_width = buffer.width, .min_height = buffer.height, .max_width = buffer.width, .max_height = buffer.height };
-	XSetStandardProperties(display, window, "My game", 0, 0, 0, 0, &hints);
-#endif
+	if (render_width) {
+		XSizeHints hints = { .flags = PMinSize, .min_width = render_width, .min_height = render_height };
+		XSetStandardProperties(display, window, "My game", 0, 0, 0, 0, &hints);
+	} else {
+		XSizeHints hints = { .flags = PMinSize | PMaxSize, .min_width = buffer.width, .min_height = buffer.height, .max_width = buffer.width, .max_height = buffer.height };
+		XSetStandardProperties(display, window, "My game", 0, 0, 0, 0, &hints);
+	}
 
-	auto gc = XCreateGC(display, window, 0, 0);
+	// Without --render-size the game draws straight into the XImage, addressing rows as width * pixel size.
+	// The window can't be resized in that mode, so checking the first image is enough.
+	if (!render_target.buffer && buffer.ximage->bytes_per_line != buffer.pitch()) {
+		fprintf(stderr, "XImage rows are %i bytes, expected %i, try --render-size\n", buffer.ximage->bytes_per_line, buffer.pitch());
+		return device_startup_fail(device_startup);
+	}
 
 	auto wm_delete_window_msg = XInternAtom(display, "WM_DELETE_WINDOW", 0);
 	if (!XSetWMProtocols(display, window, &wm_delete_window_msg, 1)) {
@@ -260,51 +401,84 @@ int main()
 	game_memory.trans_storage_size = GiB(2);
 	game_memory.perm_storage = mmap(base_addr, game_memory.perm_storage_size + game_memory.trans_storage_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 	printf("mmap on %p\n", game_memory.perm_storage);
-	game_memory.trans_storage = (u8*)game_memory.perm_storage + game_memory.trans_storage_size;
+	game_memory.trans_storage = (u8*)game_memory.perm_storage + game_memory.perm_storage_size;
 
 	if (!game_memory.perm_storage || game_memory.perm_storage == MAP_FAILED
 		|| !game_memory.trans_storage || game_memory.trans_storage == MAP_FAILED) {
 		fprintf(stderr, "Failed to allocate game memory: %s!\n", strerror(errno));
-		return 1;
+		return device_startup_fail(device_startup);
 	}
 
+	job_system_setup(game_memory.jobs);
+
+	PerfCounters perf;
+	const auto has_perf = perf_counters_setup(perf);
+
+	FrameStats frame_stats;
+	frame_stats_setup(frame_stats);
+	i64 stage_ns[FrameStage_Count] = {};
+
+	Telemetry telemetry;
+	telemetry_setup(telemetry);
+	TelemetryFrame telemetry_frame = {};
+
+#if INTERNAL
+	// Must start before the game first touches perm_storage
+	RewindBuffer rewind;
+	const auto has_rewind = rewind_init(rewind, game_memory.perm_storage, game_memory.perm_storage_size, rewind_history_size, rewind_max_snapshots);
+	auto was_rewinding = false;
+#endif
+
 	GameInput inputs[2] = {};
 	auto& prev_input = inputs[0];
 	auto& new_input = inputs[1];
 
-	Joystick joysticks[max_joy_count] = {};
-	JoystickInotify joystick_inotify;
-
-	get_joysticks(joysticks, max_joy_count);
-
-	joystick_inotify_setup(joystick_inotify);
+	Speculation speculation = {};
+	auto speculation_inputs = (GameInput*)malloc(speculation_branch_count * speculation_steps * sizeof(GameInput));
 
-	SoundOutput sound_output = {};
-	if (!alsa_setup(sound_output)) {
-		printf("[ALSA]: Failed to init alsa\n");
+	Capture capture = {};
+	if (capture_name) {
+		const auto capture_width = render_target.buffer ? render_target.width : buffer.width;
+		const auto capture_height = render_target.buffer ? render_target.height : buffer.height;
+		capture_setup(capture, capture_name, capture_width, capture_height, sound_output.frame_rate, sound_output.channel_num);
 	}
 
-	sound_output.sample_buffer = (i16*)calloc(sound_output.byte_size(), 1); // @Volatile_bit_depth
-	write_sound_buffer(sound_output, sound_output.frame_rate / 15);
-
 	//	XKeyEvent prev_key_event = {};
 	//	bool key_is_pressed = false;
 
+	auto window_width = buffer.width;
+	auto window_height = buffer.height;
 	auto buffer_size_changed = false;
+	i64 update_accumulator_ns = 0;
+	i64 ns_last_frame = 0;
+	u64 frame_index = 0;
 	auto timer_start = get_ns_time();
+	auto frame_start = timer_start;
 	auto cycle_count_start = __rdtsc();
+	auto perf_frame_start = perf_sample(perf);
 	is_running = true;
 	while (is_running) {
 
-		joystick_inotify_update(joystick_inotify, joysticks, max_joy_count);
+		if (!has_devices && __atomic_load_n(&device_startup.is_ready, __ATOMIC_ACQUIRE)) {
+			device_startup_join(device_startup);
+			has_devices = true;
+			LOG_INFO("[STARTUP]: Devices ready after %.1fms\n", (device_startup.ready_ns - startup_ns) / 1e6);
+		}
+
+		if (has_devices)
+			joystick_inotify_update(joystick_inotify, joysticks, max_joy_count);
 
-		for (int i = 0; i < max_joy_count; i++) {
+		const auto joystick_read_ns = get_ns_time();
+		for (int i = 0; has_devices && i < max_joy_count; i++) {
 			const auto ctrl_index = i + max_keyboard_count;
 			const auto& prev_ctrl = prev_input.ctrls[ctrl_index];
 			auto& new_ctrl = new_input.ctrls[ctrl_index];
 			auto& joy = joysticks[i];
 			js_event joy_event;
 			while (joy.fd && read(joy.fd, &joy_event, sizeof(joy_event)) > 0) {
+				telemetry_frame.input_events++;
+				if (!(joy_event.type & JS_EVENT_INIT))
+					input_latency_tag(input_latency, InputSource_Joystick, joy_event.time, joystick_read_ns);
 				if (joy_event.type & JS_EVENT_BUTTON) {
 
 					// printf("[JOYSTICK]: Button %i %s\n", joy_event.number, joy_event.value ? "pressed" : "released");
@@ -349,27 +523,30 @@ int main()
 		while (XPending(display) > 0) {
 			XEvent event;
 			XNextEvent(display, &event);
+			telemetry_frame.input_events++;
+			if (event.type == KeyPress || event.type == KeyRelease)
+				input_latency_tag(input_latency, InputSource_Keyboard, event.xkey.time, get_ns_time());
 			switch (event.type) {
 			case DestroyNotify: {
 				is_running = false;
-				printf("DestroyNotify\n");
+				LOG_INFO("DestroyNotify\n");
 			} break;
 			case ClientMessage: {
 				auto& msg = *(XClientMessageEvent*)&event;
 				if (msg.data.l[0] == (long)wm_delete_window_msg) {
 					is_running = false;
-					printf("[MSG]: ClientMessage\n");
+					LOG_INFO("[MSG]: ClientMessage\n");
 				}
 			} break;
 			case ConfigureNotify: {
 				auto& msg = *(XConfigureEvent*)&event;
 
-				if (msg.width != buffer.width) {
-					buffer.width = msg.width;
+				if (msg.width != window_width) {
+					window_width = msg.width;
 					buffer_size_changed = true;
 				}
-				if (msg.height != buffer.height) {
-					buffer.height = msg.height;
+				if (msg.height != window_height) {
+					window_height = msg.height;
 					buffer_size_changed = true;
 				}
 			} break;
@@ -378,38 +555,114 @@ int main()
 			}
 		}
 		if (buffer_size_changed) {
-			printf("BufferSizeChanged\n");
-			delete_screen_buffer(buffer, display);
-			if (!create_screen_buffer(buffer, buffer.width, buffer.height, 32, vinfo, display)) {
-				delete_screen_buffer(buffer, display);
-				return 1;
+			LOG_DEBUG("BufferSizeChanged\n");
+			if (!presenter_resize(presenter, window_width, window_height)) {
+				presenter_destroy(presenter);
+				return device_startup_fail(device_startup);
 			}
 			buffer_size_changed = false;
 		}
 
-		auto expected_sound_frames_per_video_frame = sound_output.frame_rate / 20;
+		stage_ns[FrameStage_Input] = get_ns_time() - timer_start;
 
-		snd_pcm_sframes_t delay, avail;
-		snd_pcm_avail_delay(sound_output.handle, &avail, &delay);
-		expected_sound_frames_per_video_frame -= delay;
+		// Frames before the devices are ready render silence that is never written
+		snd_pcm_sframes_t delay = 0, avail = 0;
+		snd_pcm_sframes_t expected_sound_frames_per_video_frame = 0;
+		if (has_devices) {
+			snd_pcm_avail_delay(sound_output.handle, &avail, &delay);
+			audio_latency_update(audio_latency, sound_output, frame_stats.frame_count ? ns_last_frame : game_update_ns, delay);
+			expected_sound_frames_per_video_frame = audio_latency.target_frames - delay;
+		}
 
 		auto frames_to_write = expected_sound_frames_per_video_frame > avail ? avail : expected_sound_frames_per_video_frame;
 		if (frames_to_write < 0)
 			frames_to_write = 0;
 
-		GameScreenBuffer game_buffer = { .width = buffer.width, .height = buffer.height, .pixel_bits = buffer.pixel_bits, .buffer = buffer.buffer };
+		int window_pitch;
+		auto game_buffer = presenter_acquire(presenter, window_pitch);
+		const auto window_buffer = game_buffer.buffer;
+		if (render_target.buffer)
+			game_buffer = render_target;
 		GameSoundBuffer game_sound_buffer = { .frame_rate = sound_output.frame_rate, .channel_num = sound_output.channel_num, .sample_buffer = sound_output.sample_buffer, .frame_count = frames_to_write };
 
-		game_update_and_render(game_memory, game_buffer, game_sound_buffer, new_input);
-		write_sound_buffer(sound_output, frames_to_write);
+		const auto frame_now = get_ns_time();
+		update_accumulator_ns += frame_now - frame_start;
+		frame_start = frame_now;
 
-		if (use_xshm) {
-			XShmPutImage(display, window, gc, buffer.ximage, 0, 0, 0, 0, buffer.width, buffer.height, 0);
-			XFlush(display);
-		} else {
-			XPutImage(display, window, gc, buffer.ximage, 0, 0, 0, 0, buffer.width, buffer.height);
+		const auto game_start = frame_now;
+		const auto perf_game_start = perf_sample(perf);
+		auto update_count = 0;
+#if INTERNAL
+		if (has_rewind && is_rewinding) {
+			if (!was_rewinding)
+				LOG_INFO("[REWIND]: %u snapshots, %.2f MiB\n", rewind.delta_count, (double)rewind_history_bytes(rewind) / MiB(1));
+			if (frame_index % rewind_snapshot_interval == 0)
+				rewind_step_back(rewind);
+			update_accumulator_ns = 0;
+		}
+		was_rewinding = is_rewinding;
+#endif
+		while (update_accumulator_ns >= game_update_ns && update_count < max_updates_per_frame) {
+			game_update(game_memory, new_input, game_update_dt);
+			update_accumulator_ns -= game_update_ns;
+			update_count++;
+		}
+		if (update_accumulator_ns >= game_update_ns)
+			update_accumulator_ns %= game_update_ns;
+		if (update_count)
+			input_latency_consumed(input_latency, game_start);
+
+		const auto alpha = (float)update_accumulator_ns / game_update_ns;
+		game_render(game_memory, game_buffer, game_sound_buffer, alpha);
+		const auto perf_game = perf_sample_delta(perf_game_start, perf_sample(perf));
+#if INTERNAL
+		if (has_rewind && !is_rewinding && frame_index % rewind_snapshot_interval == 0)
+			rewind_snapshot(rewind);
+#endif
+		frame_index++;
+
+		const auto audio_start = get_ns_time();
+		stage_ns[FrameStage_Game] = audio_start - game_start;
+		if (has_devices)
+			write_sound_buffer(sound_output, frames_to_write);
+		capture_audio(capture, sound_output.sample_buffer, frames_to_write);
+
+		const auto present_start = get_ns_time();
+		stage_ns[FrameStage_Audio] = present_start - audio_start;
+		if (render_target.buffer) {
+			if (upscaler_prepare(upscaler, render_target.width, render_target.height, buffer.width, buffer.height))
+				upscale_nearest(upscaler, render_target, window_buffer, window_pitch);
+			else
+				upscale_unscaled(render_target, window_buffer, window_pitch, buffer.width, buffer.height);
 		}
 
+		presenter_present(presenter);
+		input_latency_presented(input_latency, present_start, get_ns_time());
+		if (frame_index == 1)
+			LOG_INFO("[STARTUP]: First frame after %.1fms\n", (get_ns_time() - startup_ns) / 1e6);
+		capture_video(capture, game_buffer, present_start);
+		stage_ns[FrameStage_Present] = get_ns_time() - present_start;
+
+		// Between frames with no jobs running, the children start from the state that was just presented
+		if (speculation.running_count && speculation_poll(speculation))
+			speculation_report(speculation, speculation_branch_names);
+		if (should_speculate && !speculation.running_count && speculation_inputs) {
+			for (int branch = 0; branch < speculation_branch_count; branch++) {
+				auto branch_input = new_input;
+				auto& keyboard = branch_input.ctrls[0];
+				for (auto& button : keyboard.buttons) {
+					button = {};
+				}
+				if (branch)
+					keyboard.buttons[branch - 1].ended_down = true;
+				for (int step = 0; step < speculation_steps; step++) {
+					speculation_inputs[branch * speculation_steps + step] = branch_input;
+				}
+			}
+			speculation_start(speculation, game_memory, game_buffer, speculation_inputs, speculation_branch_count, speculation_steps);
+		}
+		should_speculate = false;
+
 		std::swap(new_input, prev_input);
 
 		static int printf_timer = 0;
@@ -421,7 +674,8 @@ int main()
 			const auto log_avail = (float)avail / (float)sound_output.frame_rate;
 			const auto log_expected = (float)expected_sound_frames_per_video_frame / (float)sound_output.frame_rate;
 			const auto log_filling = (float)frames_to_write / (float)sound_output.frame_rate;
-			printf("[ALSA]: Delay: %.3fs, Avail: %.3fs, Expected: %.3fs, Filling: %.3fs\n", log_delay, log_avail, log_expected, log_filling);
+			const auto log_target = (float)audio_latency.target_frames / (float)sound_output.frame_rate;
+			LOG_DEBUG("[ALSA]: Delay: %.3fs, Avail: %.3fs, Expected: %.3fs, Filling: %.3fs, Target: %.3fs\n", log_delay, log_avail, log_expected, log_filling, log_target);
 		}
 #endif
 
@@ -429,10 +683,44 @@ int main()
 		const auto cycle_count_end = __rdtsc();
 		const auto ns_elapsed = timer_end - timer_start;
 		const auto cycles_elapsed = cycle_count_end - cycle_count_start;
+		frame_stats_record(frame_stats, ns_elapsed, stage_ns);
+		ns_last_frame = ns_elapsed;
+		if (should_report_frames) {
+			should_report_frames = false;
+			frame_stats_report(frame_stats);
+			frame_stats_dump(frame_stats, frame_stats_filename);
+			input_latency_report(input_latency);
+		}
+
+		const auto perf_frame_end = perf_sample(perf);
+		const auto perf_frame = perf_sample_delta(perf_frame_start, perf_frame_end);
 #if FPS
-		if (ns_elapsed > 0 && printf_timer % 100 == 0)
-			printf("[PERF]: %.2fms %ifps %.2fmc\n", ns_elapsed / 1e6, (int)(1e9 / ns_elapsed), cycles_elapsed / 1e6);
+		if (ns_elapsed > 0 && printf_timer % 100 == 0) {
+			LOG_INFO("[PERF]: %.2fms %ifps %.2fmc\n", ns_elapsed / 1e6, (int)(1e9 / ns_elapsed), cycles_elapsed / 1e6);
+			if (has_perf) {
+				const auto* const frame = perf_frame.values;
+				const auto ipc = frame[PerfCounter_Cycles] ? (double)frame[PerfCounter_Instructions] / frame[PerfCounter_Cycles] : 0.0;
+				const auto game_share = frame[PerfCounter_Cycles] ? 100.0 * perf_game.values[PerfCounter_Cycles] / frame[PerfCounter_Cycles] : 0.0;
+				LOG_INFO("[PERF]: %.2f IPC, %lu cache misses, %lu branch misses, %lu page faults, game %.0f%% of cycles\n", ipc,
+					frame[PerfCounter_CacheMisses], frame[PerfCounter_BranchMisses], frame[PerfCounter_PageFaults], game_share);
+			}
+		}
 #endif
+		perf_frame_start = perf_frame_end;
+
+		telemetry_frame.frame_index = frame_index;
+		telemetry_frame.frame_ns = ns_elapsed;
+		telemetry_frame.frame_cycles = cycles_elapsed;
+		telemetry_frame.audio_delay = delay;
+		telemetry_frame.audio_avail = avail;
+		telemetry_frame.audio_underruns = has_devices ? sound_output.underrun_count : 0; // The startup thread writes it until joined
+		telemetry_frame.update_count = update_count;
+		if (game_memory.perm_storage_used > telemetry_frame.perm_storage_high_water)
+			telemetry_frame.perm_storage_high_water = game_memory.perm_storage_used;
+		if (game_memory.trans_storage_used > telemetry_frame.trans_storage_high_water)
+			telemetry_frame.trans_storage_high_water = game_memory.trans_storage_used;
+		telemetry_publish(telemetry, telemetry_frame);
+		telemetry_frame.input_events = 0;
 
 		timer_start = timer_end;
 		cycle_count_start = cycle_count_end;
@@ -441,8 +729,19 @@ int main()
 	// snd_pcm_drain(sound_output.handle);
 	// snd_pcm_close(sound_output.handle);
 
-	delete_screen_buffer(buffer, display);
+	frame_stats_report(frame_stats);
+	frame_stats_dump(frame_stats, frame_stats_filename);
+	input_latency_report(input_latency);
+
+	speculation_cancel(speculation);
+	capture_close(capture);
+	telemetry_close(telemetry);
+	perf_counters_close(perf);
+	job_system_shutdown();
+	presenter_destroy(presenter);
+	device_startup_join(device_startup);
 	joystick_inotify_close(joystick_inotify);
 
-	printf("END OF THE PROGRAM!\n");
+	LOG_INFO("END OF THE PROGRAM!\n");
+	log_shutdown();
 }
@@ -0,0 +1,270 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdbe.h>
+#include <stdio.h>
+#include <sys/shm.h>
+
+#include "game.h"
+#include "linux_log.h"
+#include "types.h"
+
+// Ways of getting the frame from our memory onto the window, all behind the same create/resize/acquire/present/destroy.
+// XShm:      the image lives in a shared memory segment the server reads from directly.
+// XPutImage: the image gets copied through the X connection every frame, works on any display.
+// Xdbe:      the image gets put into the window's back buffer, then the buffers are swapped as one request.
+//            Uses a shared memory image when the server has MIT-SHM.
+
+enum PresentBackend {
+	PresentBackend_Auto, // Probe in the order below
+	PresentBackend_XShm,
+	PresentBackend_XPutImage,
+	PresentBackend_Xdbe,
+};
+
+const char* present_backend_name(const PresentBackend backend)
+{
+	switch (backend) {
+	case PresentBackend_XShm:
+		return "XShm";
+	case PresentBackend_XPutImage:
+		return "XPutImage";
+	case PresentBackend_Xdbe:
+		return "Xdbe";
+	default:
+		return "Auto";
+	}
+}
+
+bool present_backend_parse(const char* name, PresentBackend& backend)
+{
+	if (strcmp(name, "xshm") == 0)
+		backend = PresentBackend_XShm;
+	else if (strcmp(name, "putimage") == 0)
+		backend = PresentBackend_XPutImage;
+	else if (strcmp(name, "xdbe") == 0)
+		backend = PresentBackend_Xdbe;
+	else if (strcmp(name, "auto") == 0)
+		backend = PresentBackend_Auto;
+	else
+		return false;
+	return true;
+}
+
+struct ScreenBuffer {
+	int width;
+	int height;
+	int pixel_bits;
+	PixelFormat format;
+	char* buffer;
+	XImage* ximage;
+	XShmSegmentInfo shminfo;
+	bool is_shm;
+	int pixel_bytes() const
+	{
+		return pixel_bits / 8;
+	}
+	int byte_size() const { return width * height * pixel_bytes(); }
+	int pitch() const { return width * pixel_bytes(); }
+};
+
+void delete_screen_buffer(ScreenBuffer& buffer, Display* display)
+{
+	if (!buffer.ximage)
+		return;
+
+	if (buffer.is_shm) {
+		XSync(display, 0); // The server may still be reading the segment
+		XShmDetach(display, &buffer.shminfo);
+		shmdt(buffer.shminfo.shmaddr);
+		buffer.ximage->data = 0; // Not malloced, XDestroyImage would free it
+	}
+	XDestroyImage(buffer.ximage);
+	buffer.ximage = 0;
+	buffer.buffer = 0;
+}
+
+bool create_screen_buffer(ScreenBuffer& buffer, int width, int height, PixelFormat format, bool use_shm, const XVisualInfo& vinfo, Display* display)
+{
+	buffer.width = width;
+	buffer.height = height;
+	buffer.format = format;
+	buffer.pixel_bits = pixel_format_bits(format);
+	buffer.is_shm = use_shm;
+	const auto pixel_bits = buffer.pixel_bits;
+
+	if (use_shm) {
+		buffer.ximage = XShmCreateImage(display, vinfo.visual, vinfo.depth, ZPixmap, 0, &buffer.shminfo, width, height);
+		buffer.shminfo.shmid = shmget(IPC_PRIVATE, buffer.ximage->bytes_per_line * buffer.ximage->height, IPC_CREAT | 0777);
+		buffer.buffer = buffer.shminfo.shmaddr = buffer.ximage->data = (char*)shmat(buffer.shminfo.shmid, 0, 0);
+		buffer.shminfo.readOnly = 1;
+
+		if (!XShmAttach(display, &buffer.shminfo)) {
+			LOG_ERROR("Failed to XShmAttach\n");
+			return 0;
+		}
+
+		shmctl(buffer.shminfo.shmid, IPC_RMID, 0); // Mark shared buffer for removal after process end; cant do on create_buffer because it crashes
+
+		LOG_INFO("[MIT-SHM]: Shared memory KID=%d, at=%p\n", buffer.shminfo.shmid, (void*)buffer.shminfo.shmaddr);
+
+	} else {
+		buffer.buffer = (char*)malloc(buffer.byte_size());
+		if (!buffer.buffer) {
+			LOG_ERROR("Failed to malloc\n");
+			return 0;
+		}
+
+		// Byte padding keeps 16 and 24-bit rows at exactly width * pixel size
+		buffer.ximage = XCreateImage(display, vinfo.visual, vinfo.depth, ZPixmap, 0, buffer.buffer, width, height, pixel_bits == 32 ? 32 : 8, 0);
+	}
+
+	return 1;
+}
+
+struct Presenter {
+	PresentBackend backend;
+	Display* display;
+	Window window;
+	GC gc;
+	XVisualInfo vinfo;
+	ScreenBuffer buffer;
+	XdbeBackBuffer back_buffer; // Xdbe only
+	bool is_synced; // Present waits until the server has processed the put, for latency measurement
+};
+
+bool xdbe_supports_visual(Display* display, const XVisualInfo& vinfo)
+{
+	int major, minor;
+	if (!XdbeQueryExtension(display, &major, &minor))
+		return false;
+
+	auto root = DefaultRootWindow(display);
+	int screen_count = 1;
+	auto info = XdbeGetVisualInfo(display, &root, &screen_count);
+	if (!info)
+		return false;
+
+	auto is_supported = false;
+	for (int i = 0; i < info->count; i++) {
+		if (info->visinfo[i].visual == vinfo.visualid)
+			is_supported = true;
+	}
+	XdbeFreeVisualInfo(info);
+	return is_supported;
+}
+
+bool presenter_try_create(Presenter& presenter, PresentBackend backend, int width, int height, PixelFormat format)
+{
+	auto display = presenter.display;
+	const auto has_shm = XShmQueryExtension(display);
+	switch (backend) {
+	case PresentBackend_XShm:
+		if (!has_shm) {
+			fprintf(stderr, "No XShm support\n");
+			return false;
+		}
+		break;
+	case PresentBackend_Xdbe:
+		if (!xdbe_supports_visual(display, presenter.vinfo)) {
+			fprintf(stderr, "No Xdbe support for visual 0x%lx\n", presenter.vinfo.visualid);
+			return false;
+		}
+		presenter.back_buffer = XdbeAllocateBackBufferName(display, presenter.window, XdbeUndefined); // Every pixel gets overwritten
+		break;
+	default:
+		break;
+	}
+
+	const auto use_shm = backend != PresentBackend_XPutImage && has_shm;
+	if (!create_screen_buffer(presenter.buffer, width, height, format, use_shm, presenter.vinfo, display)) {
+		delete_screen_buffer(presenter.buffer, display);
+		if (backend == PresentBackend_Xdbe)
+			XdbeDeallocateBackBufferName(display, presenter.back_buffer);
+		return false;
+	}
+
+	presenter.backend = backend;
+	return true;
+}
+
+// The window must use vinfo's visual. Auto tries XShm, then Xdbe, then XPutImage, which works everywhere.
+bool presenter_create(Presenter& presenter, PresentBackend backend, Display* display, Window window, const XVisualInfo& vinfo, int width, int height, PixelFormat format)
+{
+	presenter = {};
+	presenter.display = display;
+	presenter.window = window;
+	presenter.vinfo = vinfo;
+	presenter.gc = XCreateGC(display, window, 0, 0);
+
+	auto is_created = false;
+	if (backend == PresentBackend_Auto) {
+		const PresentBackend probe_order[] = { PresentBackend_XShm, PresentBackend_Xdbe, PresentBackend_XPutImage };
+		for (const auto probe : probe_order) {
+			if (presenter_try_create(presenter, probe, width, height, format)) {
+				is_created = true;
+				break;
+			}
+		}
+	} else {
+		is_created = presenter_try_create(presenter, backend, width, height, format);
+	}
+
+	if (!is_created) {
+		fprintf(stderr, "Failed to create the %s presenter\n", present_backend_name(backend));
+		XFreeGC(display, presenter.gc);
+		return false;
+	}
+
+	printf("Presenting with %s\n", present_backend_name(presenter.backend));
+	return true;
+}
+
+bool presenter_resize(Presenter& presenter, int width, int height)
+{
+	delete_screen_buffer(presenter.buffer, presenter.display);
+	return create_screen_buffer(presenter.buffer, width, height, presenter.buffer.format, presenter.buffer.is_shm, presenter.vinfo, presenter.display);
+}
+
+// The image to draw the next frame into, pitch is the XImage's row size which may be padded past width
+GameScreenBuffer presenter_acquire(const Presenter& presenter, int& pitch)
+{
+	const auto& buffer = presenter.buffer;
+	pitch = buffer.ximage->bytes_per_line;
+	return { .width = buffer.width, .height = buffer.height, .pixel_bits = buffer.pixel_bits, .buffer = buffer.buffer, .format = buffer.format };
+}
+
+void presenter_put_image(const Presenter& presenter, Drawable drawable)
+{
+	const auto& buffer = presenter.buffer;
+	if (buffer.is_shm)
+		XShmPutImage(presenter.display, drawable, presenter.gc, buffer.ximage, 0, 0, 0, 0, buffer.width, buffer.height, 0);
+	else
+		XPutImage(presenter.display, drawable, presenter.gc, buffer.ximage, 0, 0, 0, 0, buffer.width, buffer.height);
+}
+
+void presenter_present(const Presenter& presenter)
+{
+	switch (presenter.backend) {
+	case PresentBackend_Xdbe: {
+		presenter_put_image(presenter, presenter.back_buffer);
+		XdbeSwapInfo swap_info = { .swap_window = presenter.window, .swap_action = XdbeUndefined };
+		XdbeSwapBuffers(presenter.display, &swap_info, 1);
+	} break;
+	default:
+		presenter_put_image(presenter, presenter.window);
+		break;
+	}
+	if (presenter.is_synced)
+		XSync(presenter.display, 0);
+	else
+		XFlush(presenter.display);
+}
+
+void presenter_destroy(Presenter& presenter)
+{
+	delete_screen_buffer(presenter.buffer, presenter.display);
+	if (presenter.backend == PresentBackend_Xdbe)
+		XdbeDeallocateBackBufferName(presenter.display, presenter.back_buffer);
+	XFreeGC(presenter.display, presenter.gc);
+}